@@ -0,0 +1,368 @@
+/*
+    assetbake
+
+    Converts the text and compressed source assets under media/ into the
+    formats the runtime maps directly:
+        *.obj -> baked/<path>.obj.mesh  indexed binary mesh in vertex cache order,
+                                        see meshfile.cpp and meshopt.cpp
+        *.png -> baked/<path>.png.tex   mip chain, BC1 (RGB) or BC3 (RGBA) compressed,
+                                        see texturefile.cpp and texturecompress.cpp
+
+    <path> is the source's path as given, subdirectories of media/ included,
+    so media/a/x.png and media/b/x.png bake to different files.
+
+    baked/manifest.txt lists every output with the hash of its source and
+    of the output itself. Inputs whose hash matches the manifest and whose
+    output still exists are skipped.
+
+    All outputs are then packed into baked/assets.pack, see packfile.cpp.
+
+    g++ assetbake.cpp -O2 -std=c++11 -pthread -o assetbake && ./assetbake media baked
+*/
+#include <iostream>
+#include <stdio.h>
+#include <cstring>
+#include <thread>
+#include <atomic> // texturecompress.cpp
+#ifdef __SSE2__
+#include <emmintrin.h> // texturecompress.cpp
+#endif
+#include <dirent.h>
+
+#include <glm/glm.hpp>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "memory.h"
+#include "file_map.h"
+
+using namespace std;
+
+#include "objectloader.cpp"
+#include "meshopt.cpp"
+#include "simplify.cpp"
+#include "hull.cpp"
+#include "packfile.cpp"
+#include "meshfile.cpp"
+#include "texturefile.cpp"
+#include "texturecompress.cpp"
+
+#define MAX_ASSETS 512
+
+struct ManifestEntry
+{
+    char type[8];
+    char source[512];
+    char output[512];
+    u8 source_hash;
+    u8 output_hash;
+};
+
+struct Manifest
+{
+    ManifestEntry entries[MAX_ASSETS];
+    u4 count;
+};
+
+void read_manifest(const char* path, Manifest &manifest)
+{
+    manifest.count = 0;
+    FILE* file = fopen(path, "r");
+    if (!file) return;
+
+    ManifestEntry e;
+    unsigned long long source_hash, output_hash;
+    while (manifest.count < MAX_ASSETS &&
+           fscanf(file, "%7s %511s %llx %511s %llx", e.type, e.source, &source_hash, e.output, &output_hash) == 5)
+    {
+        e.source_hash = source_hash;
+        e.output_hash = output_hash;
+        manifest.entries[manifest.count++] = e;
+    }
+    fclose(file);
+}
+
+b4 write_manifest(const char* path, Manifest &manifest)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+    for (u4 i = 0; i < manifest.count; i++)
+    {
+        ManifestEntry &e = manifest.entries[i];
+        fprintf(file, "%s %s %016llx %s %016llx\n", e.type, e.source,
+            (unsigned long long)e.source_hash, e.output, (unsigned long long)e.output_hash);
+    }
+    return fclose(file) == 0;
+}
+
+ManifestEntry* find_entry(Manifest &manifest, const char* source)
+{
+    for (u4 i = 0; i < manifest.count; i++)
+    {
+        if (strcmp(manifest.entries[i].source, source) == 0) return &manifest.entries[i];
+    }
+    return 0;
+}
+
+inline b4 has_extension(const char* name, const char* extension)
+{
+    u8 n = strlen(name), e = strlen(extension);
+    return n > e && strcmp(name + n - e, extension) == 0;
+}
+
+// parses without a source, which checks magic, version and layout
+b4 output_current(const char* path, const char* type)
+{
+    MappedFile file;
+    b4 ok;
+    if (strcmp(type, "mesh") == 0)
+    {
+        MeshData mesh;
+        ok = open_mesh_file(path, file, mesh);
+    }
+    else
+    {
+        TextureData texture;
+        ok = open_texture_file(path, file, texture);
+    }
+    unmap_file(file);
+    return ok;
+}
+
+// mkdir -p for the directory part of path
+void make_parent_dirs(const char* path)
+{
+    char dir[512];
+    snprintf(dir, sizeof(dir), "%s", path);
+    for (char* c = dir + 1; *c; c++)
+    {
+        if (*c != '/') continue;
+        *c = 0;
+        mkdir(dir, 0755);
+        *c = '/';
+    }
+}
+
+b4 bake_mesh(const char* source_path, const char* output_path, AssetSource &source)
+{
+    uint64_t start = permanent_mark(memory);
+    MeshData mesh;
+    b4 ok = loadOBJ(source_path, memory, mesh);
+    if (ok)
+    {
+        f4 before = mesh_acmr(mesh.indices, mesh.lod_index_count[0], mesh.vertex_count, memory);
+        process_mesh(mesh, memory);
+        f4 after = mesh_acmr(mesh.indices, mesh.lod_index_count[0], mesh.vertex_count, memory);
+        printf("%s: ACMR %.3f -> %.3f\n", source_path, before, after);
+    }
+    ok = ok && write_mesh_file(output_path, mesh, source);
+    release_permanent(memory, start);
+    return ok;
+}
+
+b4 bake_texture(const char* source_path, const char* output_path, AssetSource &source)
+{
+    // RGB unless the image has alpha
+    int x, y, n;
+    if (!stbi_info(source_path, &x, &y, &n)) return false;
+    u4 format = (n == 2 || n == 4) ? TEXTURE_RGBA8 : TEXTURE_RGB8;
+
+    u1* pixels = stbi_load(source_path, &x, &y, &n, texture_components(format));
+    if (!pixels) return false;
+
+    TextureData texture;
+    b4 ok = build_mip_chain(pixels, x, y, format, texture);
+    stbi_image_free(pixels);
+    if (!ok) return false;
+
+    uint64_t start = transient_mark(memory);
+    TextureData compressed;
+    ok = compress_texture(texture, memory, std::thread::hardware_concurrency(), compressed)
+      && write_texture_file(output_path, compressed, source);
+    release_transient(memory, start);
+    free_mip_chain(texture);
+    return ok;
+}
+
+struct BakeStats
+{
+    u4 baked;
+    u4 skipped;
+    u4 failed;
+};
+
+/*
+    Bakes every .obj and .png under dir, subdirectories included, and
+    adds them to current
+*/
+void bake_directory(const char* path, Manifest &previous, Manifest &current, const char* output_dir, BakeStats &stats)
+{
+    DIR* dir = opendir(path);
+    if (!dir)
+    {
+        cout << "Failed to open " << path << endl;
+        stats.failed++;
+        return;
+    }
+
+    while (dirent* item = readdir(dir))
+    {
+        if (strcmp(item->d_name, ".") == 0 || strcmp(item->d_name, "..") == 0) continue;
+
+        char item_path[512];
+        s4 length = snprintf(item_path, sizeof(item_path), "%s/%s", path, item->d_name);
+        if (length < 0 || (u4)length >= sizeof(item_path))
+        {
+            cout << "Path too long, skipped: " << path << "/" << item->d_name << endl;
+            stats.failed++;
+            continue;
+        }
+
+        struct stat info;
+        if (stat(item_path, &info) != 0) continue;
+        if (S_ISDIR(info.st_mode))
+        {
+            bake_directory(item_path, previous, current, output_dir, stats);
+            continue;
+        }
+
+        const char* type;
+        const char* extension;
+        if      (has_extension(item->d_name, ".obj")) { type = "mesh";    extension = ".mesh"; }
+        else if (has_extension(item->d_name, ".png")) { type = "texture"; extension = ".tex"; }
+        else continue;
+
+        if (current.count == MAX_ASSETS)
+        {
+            cout << "Too many assets, increase MAX_ASSETS" << endl;
+            break;
+        }
+
+        ManifestEntry &entry = current.entries[current.count];
+        entry = {};
+        snprintf(entry.type, sizeof(entry.type), "%s", type);
+        snprintf(entry.source, sizeof(entry.source), "%s", item_path);
+        if (!baked_path(entry.source, extension, entry.output, sizeof(entry.output), output_dir))
+        {
+            cout << "Output path too long, skipped: " << entry.source << endl;
+            stats.failed++;
+            continue;
+        }
+
+        AssetSource source;
+        if (!get_asset_source(entry.source, source)) continue;
+        entry.source_hash = source_hash(source);
+
+        /*
+            Skip when the source is unchanged and the output is still what
+            we wrote, in the current format version
+        */
+        ManifestEntry* old = find_entry(previous, entry.source);
+        u8 output_hash;
+        if (old && old->source_hash == entry.source_hash && strcmp(old->output, entry.output) == 0
+            && hash_file(entry.output, output_hash) && output_hash == old->output_hash
+            && output_current(entry.output, type))
+        {
+            entry.output_hash = output_hash;
+            current.count++;
+            stats.skipped++;
+            continue;
+        }
+
+        make_parent_dirs(entry.output);
+        b4 ok = strcmp(type, "mesh") == 0
+              ? bake_mesh(entry.source, entry.output, source)
+              : bake_texture(entry.source, entry.output, source);
+
+        if (!ok || !hash_file(entry.output, entry.output_hash))
+        {
+            cout << "Failed to bake " << entry.source << endl;
+            stats.failed++;
+            continue;
+        }
+
+        cout << "Baked " << entry.source << " -> " << entry.output << endl;
+        current.count++;
+        stats.baked++;
+    }
+    closedir(dir);
+}
+
+int main(int argc, char* argv[])
+{
+    const char* media_dir = argc > 1 ? argv[1] : "media";
+    const char* output_dir = argc > 2 ? argv[2] : BAKED_DIR;
+
+    initialize_memory(memory, 256, 256);
+
+    mkdir(output_dir, 0755);
+
+    char manifest_path[512];
+    snprintf(manifest_path, sizeof(manifest_path), "%s/manifest.txt", output_dir);
+
+    Manifest* previous = (Manifest*)alloc(memory, sizeof(Manifest));
+    Manifest* current = (Manifest*)alloc(memory, sizeof(Manifest));
+    if (!previous || !current) return 1;
+    read_manifest(manifest_path, *previous);
+    current->count = 0;
+
+    struct stat media_info;
+    if (stat(media_dir, &media_info) != 0 || !S_ISDIR(media_info.st_mode))
+    {
+        cout << "Failed to open " << media_dir << endl;
+        return 1;
+    }
+
+    BakeStats stats = {};
+    bake_directory(media_dir, *previous, *current, output_dir, stats);
+    u4 baked = stats.baked, skipped = stats.skipped, failed = stats.failed;
+
+    // readdir order is arbitrary, keep the manifest stable between runs
+    qsort(current->entries, current->count, sizeof(ManifestEntry), [] (const void* a, const void* b) {
+        return strcmp(((const ManifestEntry*)a)->source, ((const ManifestEntry*)b)->source);
+    });
+
+    if (!write_manifest(manifest_path, *current))
+    {
+        cout << "Failed to write " << manifest_path << endl;
+        failed++;
+    }
+
+    /*
+        Pack everything, looked up at runtime by source path
+    */
+    char pack_path[512];
+    snprintf(pack_path, sizeof(pack_path), "%s/assets.pack", output_dir);
+    // also rewritten when missing or from an older version
+    AssetPack existing;
+    b4 pack_current = open_pack(existing, pack_path);
+    close_pack(existing);
+    if (baked || !pack_current || current->count != previous->count)
+    {
+        const char* names[MAX_ASSETS];
+        const char* paths[MAX_ASSETS];
+        u4 types[MAX_ASSETS];
+        for (u4 i = 0; i < current->count; i++)
+        {
+            names[i] = current->entries[i].source;
+            paths[i] = current->entries[i].output;
+            types[i] = strcmp(current->entries[i].type, "mesh") == 0 ? PACK_MESH : PACK_TEXTURE;
+        }
+        if (write_pack(pack_path, names, paths, types, current->count))
+        {
+            cout << "Packed " << current->count << " assets -> " << pack_path << endl;
+        }
+        else
+        {
+            cout << "Failed to write " << pack_path << endl;
+            failed++;
+        }
+    }
+
+    cout << baked << " baked, " << skipped << " unchanged, " << failed << " failed" << endl;
+
+    free(memory.TransientStorage);
+    free(memory.PermanentStorage);
+    return failed ? 1 : 0;
+}
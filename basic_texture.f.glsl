@@ -1,7 +1,24 @@
 varying vec2 UV;
+
+#ifdef TEXTURE_ARRAY
+// every texture is a layer of an array, see texturearray.cpp
+uniform sampler2DArray tex_source;
+#ifdef INSTANCED
+varying float layer;
+#else
+uniform float tex_layer;
+#endif
+#else
 uniform sampler2D tex_source;
+#endif
 
 void main(void)
 {
+#if defined(TEXTURE_ARRAY) && defined(INSTANCED)
+  gl_FragColor = texture2DArray( tex_source, vec3(UV, layer) ).rgba;
+#elif defined(TEXTURE_ARRAY)
+  gl_FragColor = texture2DArray( tex_source, vec3(UV, tex_layer) ).rgba;
+#else
   gl_FragColor = texture2D( tex_source, UV ).rgba;
+#endif
 }
\ No newline at end of file
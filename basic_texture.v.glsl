@@ -1,21 +1,54 @@
 attribute vec3 coord3d;
 attribute vec2 tex_coord2d;
+attribute vec2 normal_oct;
 
+// proj * view * model comes from the CPU, model alone is for the normals
+#ifdef INSTANCED
+attribute mat4 instance_mvp;
+attribute mat4 instance_model;
+attribute float instance_layer;
+varying float layer;
+#else
+uniform mat4 mvp;
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 proj;
-uniform vec3 scale;
-uniform mat4 rotation;
+#endif
+
+// packed meshes store positions in [0,1] across their bounding box, float meshes use 0 and 1
+uniform vec3 position_offset;
+uniform vec3 position_scale;
 
 // fragment
-uniform sampler2D tex_source;
 varying vec2 UV;
+varying vec3 normal;
+
+// inverse of oct_encode in vertexformat.cpp
+vec3 oct_decode(vec2 e)
+{
+    vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+    {
+        vec2 s = vec2(e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0);
+        n.xy = (1.0 - abs(n.yx)) * s;
+    }
+    return normalize(n);
+}
 
 void main(void)
 {
-    vec3 scaled_vertex = coord3d * scale;
+    vec3 position = position_offset + coord3d * position_scale;
+
+#ifdef INSTANCED
+    gl_Position = instance_mvp * vec4(position, 1.0);
+
+    // only right for uniform scale
+    normal = normalize((instance_model * vec4(oct_decode(normal_oct), 0.0)).xyz);
+    layer = instance_layer;
+#else
+    gl_Position = mvp * vec4(position, 1.0);
 
-    gl_Position = proj * view * model * rotation * vec4(scaled_vertex.x,scaled_vertex.y,scaled_vertex.z, 1.0);
+    // only right for uniform scale
+    normal = normalize((model * vec4(oct_decode(normal_oct), 0.0)).xyz);
+#endif
 
     UV = tex_coord2d;
 }
\ No newline at end of file
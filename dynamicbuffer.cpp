@@ -0,0 +1,151 @@
+/*
+    Dynamic buffers
+
+    A ring for data written every frame (instance entries, later debug
+    lines or particles). The buffer holds DYNAMIC_BUFFER_FRAMES regions
+    of frame_size bytes, each frame appends to the next one. Appending
+    never waits on the GPU:
+        mapped     GL 3.2, or ARB_map_buffer_range and ARB_sync. Writes go
+                   through glMapBufferRange unsynchronized, a fence at the
+                   end of the frame marks when the GPU is done with the
+                   region. If it isn't by the time the ring comes back
+                   around, or a frame writes more than its region, the
+                   whole buffer is orphaned instead of waiting.
+        orphaning  otherwise. The buffer is orphaned with glBufferData
+                   at the start of every frame and filled with
+                   glBufferSubData, the driver renames the storage.
+    push_dynamic returns the byte offset of the data, for the attribute
+    pointers. The buffer name never changes, vertex arrays can keep it.
+*/
+
+#define DYNAMIC_BUFFER_FRAMES 3
+#define DYNAMIC_BUFFER_ALIGNMENT 16
+#define DYNAMIC_BUFFER_FULL 0xFFFFFFFF
+
+struct DynamicBuffer
+{
+    GLuint buffer;
+    u4 frame_size;
+    u4 region;  // the current frame's
+    u4 offset;  // next free byte in the buffer
+    u4 end;     // of the current region
+    b4 mapped;
+    GLsync fences[DYNAMIC_BUFFER_FRAMES];
+    u4 orphans; // ring wrapped early, since creation
+};
+
+void create_dynamic_buffer(DynamicBuffer &b, u4 frame_size)
+{
+    b = {};
+    b.frame_size = (frame_size + DYNAMIC_BUFFER_ALIGNMENT - 1) & ~(DYNAMIC_BUFFER_ALIGNMENT - 1);
+    b.mapped = GLEW_VERSION_3_2 || (GLEW_ARB_map_buffer_range && GLEW_ARB_sync);
+    glGenBuffers(1, &b.buffer);
+    bind_buffer(GL_ARRAY_BUFFER, b.buffer);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)b.frame_size * DYNAMIC_BUFFER_FRAMES, 0, GL_STREAM_DRAW);
+    b.end = b.frame_size;
+}
+
+void destroy_dynamic_buffer(DynamicBuffer &b)
+{
+    for (u4 i = 0; i < DYNAMIC_BUFFER_FRAMES; i++)
+    {
+        if (b.fences[i]) glDeleteSync(b.fences[i]);
+        b.fences[i] = 0;
+    }
+    delete_buffer(b.buffer);
+}
+
+// fresh storage from the driver, every region is free again
+void orphan_dynamic_buffer(DynamicBuffer &b)
+{
+    bind_buffer(GL_ARRAY_BUFFER, b.buffer);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)b.frame_size * DYNAMIC_BUFFER_FRAMES, 0, GL_STREAM_DRAW);
+    for (u4 i = 0; i < DYNAMIC_BUFFER_FRAMES; i++)
+    {
+        if (b.fences[i]) glDeleteSync(b.fences[i]);
+        b.fences[i] = 0;
+    }
+}
+
+void begin_dynamic_frame(DynamicBuffer &b)
+{
+    if (!b.buffer) return;
+
+    if (!b.mapped)
+    {
+        // the whole buffer is the frame's, nothing is left to wait on
+        orphan_dynamic_buffer(b);
+        b.region = 0;
+        b.offset = 0;
+        b.end = b.frame_size * DYNAMIC_BUFFER_FRAMES;
+        return;
+    }
+
+    b.region = (b.region + 1) % DYNAMIC_BUFFER_FRAMES;
+    b.offset = b.region * b.frame_size;
+    b.end = b.offset + b.frame_size;
+
+    GLsync &fence = b.fences[b.region];
+    if (fence)
+    {
+        // a zero timeout only polls
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED || status == GL_WAIT_FAILED)
+        {
+            orphan_dynamic_buffer(b);
+            b.orphans++;
+        }
+        else
+        {
+            glDeleteSync(fence);
+            fence = 0;
+        }
+    }
+}
+
+void end_dynamic_frame(DynamicBuffer &b)
+{
+    if (!b.buffer || !b.mapped) return;
+    if (b.fences[b.region]) glDeleteSync(b.fences[b.region]);
+    b.fences[b.region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+/*
+    Copies size bytes into the current frame's region. Returns their
+    offset in the buffer, or DYNAMIC_BUFFER_FULL if size is more than a
+    region holds.
+*/
+u4 push_dynamic(DynamicBuffer &b, const void* data, u4 size)
+{
+    u4 capacity = b.mapped ? b.frame_size : b.frame_size * DYNAMIC_BUFFER_FRAMES;
+    if (!b.buffer || size > capacity) return DYNAMIC_BUFFER_FULL;
+
+    if (b.offset + size > b.end)
+    {
+        // start the region over in fresh storage, the old one may still be read
+        orphan_dynamic_buffer(b);
+        b.offset = b.end - capacity;
+        b.orphans++;
+    }
+
+    u4 offset = b.offset;
+    bind_buffer(GL_ARRAY_BUFFER, b.buffer);
+    if (b.mapped)
+    {
+        void* target = glMapBufferRange(GL_ARRAY_BUFFER, offset, size,
+            GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if (!target) return DYNAMIC_BUFFER_FULL;
+        memcpy(target, data, size);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    else
+    {
+        glBufferSubData(GL_ARRAY_BUFFER, offset, size, data);
+    }
+
+    b.offset = (offset + size + DYNAMIC_BUFFER_ALIGNMENT - 1) & ~(DYNAMIC_BUFFER_ALIGNMENT - 1);
+    return offset;
+}
+
+// instance entries of the instanced draws, see render_functions.cpp
+global_variable DynamicBuffer instance_stream;
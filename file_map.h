@@ -0,0 +1,126 @@
+#ifndef _GAME_FILE_MAP_H_
+#define _GAME_FILE_MAP_H_
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdio.h>
+
+#include "memory.h"
+#include "handles.h" // hash_bytes
+
+/*
+    Read only file mappings. The OS pages the file in on demand, so the
+    loaders can scan or upload straight from the mapping without copying
+    the file into a buffer first.
+*/
+struct MappedFile
+{
+    u1* data = 0;
+    u8  size = 0;
+    s4  fd = -1;
+};
+
+void unmap_file(MappedFile &file)
+{
+    if (file.data) munmap(file.data, file.size);
+    if (file.fd >= 0) close(file.fd);
+    file = {};
+}
+
+b4 map_file(MappedFile &file, const char* path)
+{
+    file = {};
+    file.fd = open(path, O_RDONLY);
+    if (file.fd < 0) return false;
+
+    struct stat info;
+    if (fstat(file.fd, &info) != 0 || info.st_size <= 0)
+    {
+        unmap_file(file);
+        return false;
+    }
+    file.size = (u8)info.st_size;
+
+    void* data = mmap(0, file.size, PROT_READ, MAP_PRIVATE, file.fd, 0);
+    if (data == MAP_FAILED)
+    {
+        unmap_file(file);
+        return false;
+    }
+    // the whole file is about to be read front to back
+    madvise(data, file.size, MADV_SEQUENTIAL);
+    file.data = (u1*)data;
+
+    return true;
+}
+
+/*
+    Modification time (seconds) and size, false if the file doesn't exist
+*/
+b4 file_stat(const char* path, u8 &mtime, u8 &size)
+{
+    struct stat info;
+    if (stat(path, &info) != 0) return false;
+    mtime = (u8)info.st_mtime;
+    size = (u8)info.st_size;
+    return true;
+}
+
+// FNV-1a over the file contents, see hash_bytes
+b4 hash_file(const char* path, u8 &hash)
+{
+    MappedFile file;
+    if (!map_file(file, path)) return false;
+    hash = hash_bytes(file.data, file.size);
+    unmap_file(file);
+    return true;
+}
+
+/*
+    Identifies the source file a cached or baked asset was built from
+*/
+struct AssetSource
+{
+    const char* path;
+    u8 mtime;
+    u8 size;
+    u8 hash;
+    b4 hashed;
+};
+
+b4 get_asset_source(const char* path, AssetSource &source)
+{
+    source = {};
+    source.path = path;
+    return file_stat(path, source.mtime, source.size);
+}
+
+// Hashing reads the whole source, so only do it when needed
+u8 source_hash(AssetSource &source)
+{
+    if (!source.hashed)
+    {
+        source.hashed = hash_file(source.path, source.hash);
+    }
+    return source.hash;
+}
+
+/*
+    Where assetbake puts the baked version of a source file. The whole
+    relative path is kept, so media/a/x.png and media/b/x.png don't land
+    on the same file: media/steel.png -> baked/media/steel.png.tex
+*/
+#define BAKED_DIR "baked"
+
+// false if out was too small and the path got cut short
+b4 baked_path(const char* source, const char* extension, char* out, u4 out_size, const char* dir = BAKED_DIR)
+{
+    // absolute and ./ paths still go under dir
+    while (source[0] == '/' || (source[0] == '.' && source[1] == '/')) source += source[0] == '/' ? 1 : 2;
+    s4 length = snprintf(out, out_size, "%s/%s%s", dir, source, extension);
+    return length >= 0 && (u4)length < out_size;
+}
+
+#endif // _GAME_FILE_MAP_H_
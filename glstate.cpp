@@ -0,0 +1,219 @@
+/*
+    GL state cache
+
+    Every bind in the renderer goes through here. The cache remembers the
+    bound program, textures (unit 0, per target), buffers, vertex array
+    and which vertex attribute arrays are enabled or instanced, and drops
+    calls that wouldn't change anything. issued and skipped count the
+    calls of the current frame, draws the draw calls, end_gl_state_frame
+    keeps them in last_issued, last_skipped and last_draws and starts
+    over.
+
+    The cache only holds while nothing binds behind its back, so raw
+    glBind* calls don't belong outside this file. Deleting a bound
+    object unbinds it in GL, delete_buffer and friends do the same in the
+    cache, or a recycled name would be taken as still bound.
+*/
+
+#define GL_STATE_UNKNOWN 0xFFFFFFFF
+#define GL_STATE_MAX_ATTRIBUTES 32
+
+struct GLStateCache
+{
+    GLuint program;
+    GLuint texture_2d;
+    GLuint texture_2d_array;
+    GLuint array_buffer;
+    GLuint element_array_buffer; // part of the vertex array's state
+    GLuint vertex_array;
+    u4 attributes;               // enabled arrays of the bound vertex array, a bit each
+    u4 divisors;                 // arrays advancing per instance, same
+    b4 attributes_known;
+    b4 divisors_known;
+    u4 max_attributes;
+
+    u4 issued;
+    u4 skipped;
+    u4 draws;
+    u4 last_issued;
+    u4 last_skipped;
+    u4 last_draws;
+} gl_state;
+
+/*
+    Forgets everything, the next call of each kind goes through. Needs a
+    current context.
+*/
+void reset_gl_state()
+{
+    gl_state.program = GL_STATE_UNKNOWN;
+    gl_state.texture_2d = GL_STATE_UNKNOWN;
+    gl_state.texture_2d_array = GL_STATE_UNKNOWN;
+    gl_state.array_buffer = GL_STATE_UNKNOWN;
+    gl_state.element_array_buffer = GL_STATE_UNKNOWN;
+    gl_state.vertex_array = GL_STATE_UNKNOWN;
+    gl_state.attributes = 0;
+    gl_state.divisors = 0;
+    gl_state.attributes_known = false;
+    gl_state.divisors_known = false;
+
+    GLint max_attributes = 0;
+    glGetIntegerv(GL_MAX_VERTEX_ATTRIBS, &max_attributes);
+    gl_state.max_attributes = max_attributes > GL_STATE_MAX_ATTRIBUTES ? GL_STATE_MAX_ATTRIBUTES : (u4)max_attributes;
+}
+
+void end_gl_state_frame()
+{
+    gl_state.last_issued = gl_state.issued;
+    gl_state.last_skipped = gl_state.skipped;
+    gl_state.last_draws = gl_state.draws;
+    gl_state.issued = 0;
+    gl_state.skipped = 0;
+    gl_state.draws = 0;
+}
+
+// true when the call has to go out, value becomes the cached state
+inline b4 gl_state_changes(GLuint &cached, GLuint value)
+{
+    if (cached == value)
+    {
+        gl_state.skipped++;
+        return false;
+    }
+    cached = value;
+    gl_state.issued++;
+    return true;
+}
+
+inline void use_program(GLuint program)
+{
+    if (gl_state_changes(gl_state.program, program)) glUseProgram(program);
+}
+
+inline GLuint* gl_state_texture_slot(GLenum target)
+{
+    if (target == GL_TEXTURE_2D) return &gl_state.texture_2d;
+    if (target == GL_TEXTURE_2D_ARRAY) return &gl_state.texture_2d_array;
+    return 0;
+}
+
+inline void bind_texture(GLenum target, GLuint texture)
+{
+    GLuint* slot = gl_state_texture_slot(target);
+    if (!slot)
+    {
+        gl_state.issued++;
+        glBindTexture(target, texture);
+        return;
+    }
+    if (gl_state_changes(*slot, texture)) glBindTexture(target, texture);
+}
+
+inline void bind_buffer(GLenum target, GLuint buffer)
+{
+    GLuint &slot = target == GL_ELEMENT_ARRAY_BUFFER ? gl_state.element_array_buffer : gl_state.array_buffer;
+    if (target != GL_ELEMENT_ARRAY_BUFFER && target != GL_ARRAY_BUFFER)
+    {
+        gl_state.issued++;
+        glBindBuffer(target, buffer);
+        return;
+    }
+    if (gl_state_changes(slot, buffer)) glBindBuffer(target, buffer);
+}
+
+/*
+    The element buffer, enabled arrays and divisors belong to the vertex
+    array, so they are unknown after switching
+*/
+inline void bind_vertex_array(GLuint vertex_array)
+{
+    if (!gl_state_changes(gl_state.vertex_array, vertex_array)) return;
+    glBindVertexArray(vertex_array);
+    gl_state.element_array_buffer = GL_STATE_UNKNOWN;
+    gl_state.attributes_known = false;
+    gl_state.divisors_known = false;
+}
+
+/*
+    Enables exactly the attribute arrays in mask, bit i for location i,
+    and disables the rest
+*/
+void enable_vertex_attributes(u4 mask)
+{
+    for (u4 i = 0; i < gl_state.max_attributes; i++)
+    {
+        u4 bit = 1u << i;
+        if (gl_state.attributes_known && (gl_state.attributes & bit) == (mask & bit))
+        {
+            if (mask & bit) gl_state.skipped++;
+            continue;
+        }
+        if (mask & bit) glEnableVertexAttribArray(i);
+        else            glDisableVertexAttribArray(i);
+        gl_state.issued++;
+    }
+    gl_state.attributes = mask;
+    gl_state.attributes_known = true;
+}
+
+/*
+    Divisor 1 for the locations in mask, 0 for the rest. Needs instancing.
+*/
+void set_vertex_attribute_divisors(u4 mask)
+{
+    for (u4 i = 0; i < gl_state.max_attributes; i++)
+    {
+        u4 bit = 1u << i;
+        if (gl_state.divisors_known && (gl_state.divisors & bit) == (mask & bit))
+        {
+            if (mask & bit) gl_state.skipped++;
+            continue;
+        }
+        glVertexAttribDivisorARB(i, (mask & bit) ? 1 : 0);
+        gl_state.issued++;
+    }
+    gl_state.divisors = mask;
+    gl_state.divisors_known = true;
+}
+
+inline void delete_buffer(GLuint &buffer)
+{
+    if (!buffer) return;
+    if (gl_state.array_buffer == buffer) gl_state.array_buffer = 0;
+    if (gl_state.element_array_buffer == buffer) gl_state.element_array_buffer = 0;
+    glDeleteBuffers(1, &buffer);
+    buffer = 0;
+}
+
+inline void delete_texture(GLuint &texture)
+{
+    if (!texture) return;
+    if (gl_state.texture_2d == texture) gl_state.texture_2d = 0;
+    if (gl_state.texture_2d_array == texture) gl_state.texture_2d_array = 0;
+    glDeleteTextures(1, &texture);
+    texture = 0;
+}
+
+// the default vertex array is bound in its place
+inline void delete_vertex_array(GLuint &vertex_array)
+{
+    if (!vertex_array) return;
+    glDeleteVertexArrays(1, &vertex_array);
+    if (gl_state.vertex_array == vertex_array)
+    {
+        gl_state.vertex_array = 0;
+        gl_state.element_array_buffer = GL_STATE_UNKNOWN;
+        gl_state.attributes_known = false;
+        gl_state.divisors_known = false;
+    }
+    vertex_array = 0;
+}
+
+// a program in use is only flagged for deletion, it stays bound
+inline void delete_program(GLuint &program)
+{
+    if (!program) return;
+    glDeleteProgram(program);
+    if (gl_state.program == program) gl_state.program = GL_STATE_UNKNOWN;
+    program = 0;
+}
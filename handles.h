@@ -0,0 +1,228 @@
+#ifndef _GAME_HANDLES_H_
+#define _GAME_HANDLES_H_
+
+#include "memory.h"
+
+/*
+    Generational handles
+
+    A handle is 32 bits: the low 20 bits index a slot in the registry, the
+    high 12 bits hold the generation the slot had when the handle was made.
+    Destroying a handle bumps the slot's generation, so any copy of the old
+    handle stops validating instead of silently pointing at whatever gets
+    put in the slot next. Generation 0 is never issued, so 0 is always an
+    invalid handle.
+
+    One registry serves every kind of object: the slot remembers the type
+    so a mesh handle can't be used to look up a texture.
+
+    Names (file paths) resolve to handles through an open addressing hash
+    map. That is for load time, per frame code should hold on to handles.
+*/
+
+typedef u4 Handle;
+
+#define HANDLE_INDEX_BITS 20
+#define HANDLE_INDEX_MASK ((1u << HANDLE_INDEX_BITS) - 1)
+#define HANDLE_GENERATION_MASK 0xFFFu
+#define HANDLE_FREE_END 0xFFFFFFFFu
+
+enum HANDLE_TYPES {
+    HANDLE_NONE = 0,
+    HANDLE_ENTITY,
+    HANDLE_BODY,
+    HANDLE_MESH,
+    HANDLE_TEXTURE,
+};
+
+struct HandleSlot
+{
+    void* data;
+    u4 next_free;
+    u2 generation;
+    u2 type;
+};
+
+struct HandleName
+{
+    u8 hash;          // 0 = empty
+    const char* name; // 0 with a hash = deleted
+    Handle handle;
+};
+
+struct HandleRegistry
+{
+    HandleSlot* slots = 0;
+    u4 capacity = 0;
+    u4 used = 0;
+    u4 free_list = HANDLE_FREE_END;
+
+    HandleName* names = 0;
+    u4 name_capacity = 0; // power of two
+};
+
+global_variable HandleRegistry handles;
+
+inline u4 handle_index(Handle h)      { return h & HANDLE_INDEX_MASK; }
+inline u4 handle_generation(Handle h) { return (h >> HANDLE_INDEX_BITS) & HANDLE_GENERATION_MASK; }
+
+// FNV-1a
+inline u8 hash_bytes(const void* data, u8 size, u8 hash = 14695981039346656037ull)
+{
+    const u1* p = (const u1*)data;
+    for (u8 i = 0; i < size; i++)
+    {
+        hash ^= p[i];
+        hash *= 1099511628211ull;
+    }
+    return hash;
+}
+
+inline u8 hash_string(const char* s)
+{
+    u8 hash = hash_bytes(s, strlen(s));
+    return hash ? hash : 1; // 0 marks an empty name slot
+}
+
+void init_handles(HandleRegistry &registry, GameMemory &memory, u4 capacity, u4 name_capacity)
+{
+    u4 n = 1;
+    while (n < name_capacity * 2) n <<= 1; // keep the name map at most half full
+
+    registry.capacity = capacity < HANDLE_INDEX_MASK ? capacity : HANDLE_INDEX_MASK;
+    registry.slots = (HandleSlot*)alloc(memory, sizeof(HandleSlot) * registry.capacity);
+    memset(registry.slots, 0, sizeof(HandleSlot) * registry.capacity);
+    registry.used = 0;
+    registry.free_list = HANDLE_FREE_END;
+
+    registry.name_capacity = n;
+    registry.names = (HandleName*)alloc(memory, sizeof(HandleName) * n);
+    memset(registry.names, 0, sizeof(HandleName) * n);
+}
+
+Handle create_handle(HandleRegistry &registry, u4 type, void* data)
+{
+    u4 index;
+    if (registry.free_list != HANDLE_FREE_END)
+    {
+        index = registry.free_list;
+        registry.free_list = registry.slots[index].next_free;
+    }
+    else if (registry.used < registry.capacity)
+    {
+        index = registry.used++;
+    }
+    else
+    {
+        std::cout << "ERROR: Out of handles." << std::endl;
+        return 0;
+    }
+
+    HandleSlot &slot = registry.slots[index];
+    if (slot.generation == 0) slot.generation = 1;
+    slot.type = (u2)type;
+    slot.data = data;
+    slot.next_free = HANDLE_FREE_END;
+
+    return ((u4)slot.generation << HANDLE_INDEX_BITS) | index;
+}
+
+inline b4 valid_handle(HandleRegistry &registry, Handle h, u4 type)
+{
+    u4 index = handle_index(h);
+    if (index >= registry.used) return false;
+    HandleSlot &slot = registry.slots[index];
+    return slot.generation == handle_generation(h) && slot.type == type;
+}
+
+// Returns 0 for stale, destroyed or mistyped handles
+inline void* get_handle_data(HandleRegistry &registry, Handle h, u4 type)
+{
+    if (!valid_handle(registry, h, type)) return 0;
+    return registry.slots[handle_index(h)].data;
+}
+
+// e.g. once an asset that was loading in the background is ready
+inline void set_handle_data(HandleRegistry &registry, Handle h, void* data)
+{
+    u4 index = handle_index(h);
+    if (index >= registry.used) return;
+    HandleSlot &slot = registry.slots[index];
+    if (slot.generation == handle_generation(h) && slot.type != HANDLE_NONE) slot.data = data;
+}
+
+void destroy_handle(HandleRegistry &registry, Handle h)
+{
+    u4 index = handle_index(h);
+    if (index >= registry.used) return;
+    HandleSlot &slot = registry.slots[index];
+    if (slot.generation != handle_generation(h) || slot.type == HANDLE_NONE) return;
+
+    slot.generation = (slot.generation + 1) & HANDLE_GENERATION_MASK;
+    if (slot.generation == 0) slot.generation = 1;
+    slot.type = HANDLE_NONE;
+    slot.data = 0;
+    slot.next_free = registry.free_list;
+    registry.free_list = index;
+}
+
+/*
+    Name map
+*/
+HandleName* find_name_slot(HandleRegistry &registry, const char* name, u8 hash)
+{
+    u4 mask = registry.name_capacity - 1;
+    for (u4 i = (u4)hash & mask, probe = 0; probe < registry.name_capacity; i = (i + 1) & mask, probe++)
+    {
+        HandleName &entry = registry.names[i];
+        if (entry.hash == 0) return 0;
+        if (entry.hash == hash && entry.name && strcmp(entry.name, name) == 0) return &entry;
+    }
+    return 0;
+}
+
+// name must outlive the entry, i.e. live in permanent memory
+void bind_name(HandleRegistry &registry, const char* name, Handle h)
+{
+    u8 hash = hash_string(name);
+    HandleName* existing = find_name_slot(registry, name, hash);
+    if (existing)
+    {
+        existing->handle = h;
+        return;
+    }
+
+    u4 mask = registry.name_capacity - 1;
+    for (u4 i = (u4)hash & mask, probe = 0; probe < registry.name_capacity; i = (i + 1) & mask, probe++)
+    {
+        HandleName &entry = registry.names[i];
+        if (entry.hash == 0 || entry.name == 0)
+        {
+            entry.hash = hash;
+            entry.name = name;
+            entry.handle = h;
+            return;
+        }
+    }
+    std::cout << "ERROR: Handle name map is full." << std::endl;
+}
+
+void unbind_name(HandleRegistry &registry, const char* name)
+{
+    HandleName* entry = find_name_slot(registry, name, hash_string(name));
+    if (entry)
+    {
+        // leave the hash behind as a tombstone so probing continues past it
+        entry->name = 0;
+        entry->handle = 0;
+    }
+}
+
+Handle find_handle(HandleRegistry &registry, const char* name, u4 type)
+{
+    HandleName* entry = find_name_slot(registry, name, hash_string(name));
+    if (!entry || !valid_handle(registry, entry->handle, type)) return 0;
+    return entry->handle;
+}
+
+#endif // _GAME_HANDLES_H_
@@ -0,0 +1,158 @@
+/*
+    Hot reloading
+
+    inotify watches media/ and the directory the shaders are read from.
+    poll_hot_reload runs at the start of a frame and turns the events
+    into reloads:
+        .obj/.png  reload_mesh/reload_texture, the streaming workers load
+                   it again and process_uploads swaps the GL objects in
+        .glsl      basic_texture is rebuilt on the GL thread, the old
+                   program stays if the new one doesn't compile
+    While watching, the loaders check packed assets against their sources
+    too. Only assets that are already loaded are reloaded. The caches next to
+    the sources are stale once the source changes, so the loaders
+    rebuild them on the way. A reloaded mesh replaces its hull, and
+    bodies shaped by it get its new mass properties.
+
+    Linux only, elsewhere nothing is watched.
+*/
+
+#define HOT_RELOAD_MEDIA_DIR "media"
+#define HOT_RELOAD_SHADER_DIR "."
+#define HOT_RELOAD_MAX_EVENTS 64
+
+struct HotReload
+{
+    s4 fd = -1;
+    s4 media_watch = -1;
+    s4 shader_watch = -1;
+} hot_reload;
+
+inline b4 has_extension(const char* name, const char* extension)
+{
+    size_t length = strlen(name);
+    size_t extension_length = strlen(extension);
+    return length >= extension_length && strcmp(name + length - extension_length, extension) == 0;
+}
+
+b4 start_hot_reload()
+{
+#ifdef __linux__
+    hot_reload.fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (hot_reload.fd < 0)
+    {
+        cout << "Hot reload unavailable, inotify_init1 failed" << endl;
+        return false;
+    }
+
+    // editors usually save to a temporary and rename it over the file
+    u4 mask = IN_CLOSE_WRITE | IN_MOVED_TO;
+    hot_reload.media_watch = inotify_add_watch(hot_reload.fd, HOT_RELOAD_MEDIA_DIR, mask);
+    hot_reload.shader_watch = inotify_add_watch(hot_reload.fd, HOT_RELOAD_SHADER_DIR, mask);
+    if (hot_reload.media_watch < 0 || hot_reload.shader_watch < 0)
+    {
+        cout << "Hot reload failed to watch " HOT_RELOAD_MEDIA_DIR " or the shaders" << endl;
+    }
+    // edited sources have to win over what was packed
+    check_asset_sources = true;
+    return true;
+#else
+    return false;
+#endif
+}
+
+void stop_hot_reload()
+{
+#ifdef __linux__
+    if (hot_reload.fd >= 0) close(hot_reload.fd);
+#endif
+    hot_reload.fd = -1;
+}
+
+/*
+    Builds basic_texture (and its instanced variant) again from the files.
+    They are only replaced once both new programs link.
+*/
+b4 reload_basic_texture_shader()
+{
+    BASIC_TEXTURE_SHADER previous = basic_texture;
+    BASIC_TEXTURE_SHADER previous_instanced = basic_texture_instanced;
+    if (!create_basic_texture_shader())
+    {
+        // the plain variant may have built before the instanced one failed
+        if (basic_texture.program != previous.program) delete_program(basic_texture.program);
+        basic_texture = previous;
+        basic_texture_instanced = previous_instanced;
+        cout << "Shader reload failed, keeping the old program" << endl;
+        return false;
+    }
+    delete_program(previous.program);
+    if (instancing) delete_program(previous_instanced.program);
+    cout << "Reloaded basic_texture shader" << endl;
+    return true;
+}
+
+void reload_asset(const char* filename)
+{
+    Handle h;
+    if ((h = find_handle(handles, filename, HANDLE_MESH)) != 0)
+    {
+        Library::Mesh* mesh = lookup_mesh(h);
+        if (mesh && reload_mesh(*mesh)) cout << "Reloading " << filename << endl;
+    }
+    else if ((h = find_handle(handles, filename, HANDLE_TEXTURE)) != 0)
+    {
+        Library::Texture* texture = lookup_texture(h);
+        if (texture && reload_texture(*texture)) cout << "Reloading " << filename << endl;
+    }
+}
+
+/*
+    Call once per frame, before process_uploads. Never blocks.
+*/
+void poll_hot_reload()
+{
+#ifdef __linux__
+    if (hot_reload.fd < 0) return;
+
+    b4 shaders_changed = false;
+    char changed[HOT_RELOAD_MAX_EVENTS][256];
+    u4 changed_count = 0;
+
+    alignas(inotify_event) char buffer[4096];
+    while (1)
+    {
+        ssize_t length = read(hot_reload.fd, buffer, sizeof(buffer));
+        if (length <= 0) break; // EAGAIN, nothing more
+
+        for (char* at = buffer; at < buffer + length; at += sizeof(inotify_event) + ((inotify_event*)at)->len)
+        {
+            inotify_event* event = (inotify_event*)at;
+            if (!event->len) continue;
+
+            if (event->wd == hot_reload.shader_watch && has_extension(event->name, ".glsl"))
+            {
+                shaders_changed = true;
+                continue;
+            }
+
+            // the loaders' own cache files land in media/ too, only sources matter
+            if (event->wd != hot_reload.media_watch) continue;
+            if (!has_extension(event->name, ".obj") && !has_extension(event->name, ".png")) continue;
+
+            // one save often comes as several events
+            char name[256];
+            snprintf(name, sizeof(name), HOT_RELOAD_MEDIA_DIR "/%s", event->name);
+            b4 seen = false;
+            for (u4 i = 0; i < changed_count && !seen; i++) seen = strcmp(changed[i], name) == 0;
+            if (!seen && changed_count < HOT_RELOAD_MAX_EVENTS)
+            {
+                memcpy(changed[changed_count++], name, sizeof(name));
+            }
+        }
+    }
+
+    for (u4 i = 0; i < changed_count; i++) reload_asset(changed[i]);
+    if (shaders_changed) reload_basic_texture_shader();
+#endif
+}
@@ -0,0 +1,430 @@
+/*
+    Physics shape
+
+    Convex hull of a mesh's vertices by quickhull (Barber, Dobkin &
+    Huhdanpaa, "The Quickhull Algorithm for Convex Hulls"), capped at
+    HULL_MAX_VERTICES: the point farthest outside the current hull is
+    added first, so stopping early leaves the best hull of that size.
+
+    Volume, center of mass and inertia tensor by polyhedral integration:
+    Mirtich's surface integrals via the divergence theorem, in the
+    triangle-only form from Eberly's "Polyhedral Mass Properties
+    (Revisited)". It is exact for closed meshes. Meshes with holes get the
+    properties of their hull instead.
+*/
+
+#define HULL_MAX_VERTICES 64
+
+struct HullFace
+{
+    u4 v[3];
+    glm::vec3 normal;
+    f4 offset; // plane: dot(normal, p) = offset
+};
+
+inline glm::vec3 cross3(glm::vec3 a, glm::vec3 b)
+{
+    return glm::vec3(a.y * b.z - a.z * b.y, a.z * b.x - a.x * b.z, a.x * b.y - a.y * b.x);
+}
+
+inline HullFace make_hull_face(const glm::vec3* points, u4 a, u4 b, u4 c)
+{
+    HullFace face;
+    face.v[0] = a;
+    face.v[1] = b;
+    face.v[2] = c;
+    glm::vec3 n = cross3(points[b] - points[a], points[c] - points[a]);
+    f4 length = sqrtf(dot3(n, n));
+    face.normal = length > 0.0f ? n * (1.0f / length) : n;
+    face.offset = dot3(face.normal, points[a]);
+    return face;
+}
+
+inline f4 hull_distance(const HullFace &face, glm::vec3 p)
+{
+    return dot3(face.normal, p) - face.offset;
+}
+
+/*
+    Hull vertices and outward wound triangles go to permanent memory,
+    temporaries to transient. False if the points are (nearly) flat or
+    don't fit in memory.
+*/
+b4 build_hull(const glm::vec3* points, u4 point_count, u4 max_vertices, GameMemory &memory, MeshData &out)
+{
+    out.hull_vertices = 0;
+    out.hull_vertex_count = 0;
+    out.hull_indices = 0;
+    out.hull_index_count = 0;
+    if (point_count < 4) return false;
+    if (max_vertices < 4) max_vertices = 4;
+
+    uint64_t start = transient_mark(memory);
+
+    /*
+        Initial tetrahedron: the farthest apart of the axis extremes, the
+        point farthest from their line, the point farthest from that plane
+    */
+    u4 extreme[6] = {};
+    for (u4 i = 1; i < point_count; i++)
+    {
+        for (u4 k = 0; k < 3; k++)
+        {
+            if (points[i][k] < points[extreme[k * 2]][k])     extreme[k * 2] = i;
+            if (points[i][k] > points[extreme[k * 2 + 1]][k]) extreme[k * 2 + 1] = i;
+        }
+    }
+    f4 scale = 0.0f;
+    for (u4 k = 0; k < 3; k++)
+    {
+        scale += fabsf(points[extreme[k * 2]][k]) > fabsf(points[extreme[k * 2 + 1]][k])
+               ? fabsf(points[extreme[k * 2]][k]) : fabsf(points[extreme[k * 2 + 1]][k]);
+    }
+    const f4 epsilon = scale * 1e-5f;
+
+    u4 a = 0, b = 0;
+    f4 best = -1.0f;
+    for (u4 i = 0; i < 6; i++)
+    {
+        for (u4 j = i + 1; j < 6; j++)
+        {
+            glm::vec3 d = points[extreme[i]] - points[extreme[j]];
+            if (dot3(d, d) > best) { best = dot3(d, d); a = extreme[i]; b = extreme[j]; }
+        }
+    }
+
+    u4 c = 0;
+    best = -1.0f;
+    glm::vec3 ab = points[b] - points[a];
+    for (u4 i = 0; i < point_count; i++)
+    {
+        glm::vec3 n = cross3(ab, points[i] - points[a]);
+        if (dot3(n, n) > best) { best = dot3(n, n); c = i; }
+    }
+    if (sqrtf(best) <= epsilon * sqrtf(dot3(ab, ab)))
+    {
+        release_transient(memory, start);
+        return false;
+    }
+
+    u4 d = 0;
+    best = -1.0f;
+    HullFace base = make_hull_face(points, a, b, c);
+    for (u4 i = 0; i < point_count; i++)
+    {
+        f4 distance = fabsf(hull_distance(base, points[i]));
+        if (distance > best) { best = distance; d = i; }
+    }
+    if (best <= epsilon)
+    {
+        release_transient(memory, start);
+        return false;
+    }
+
+    /*
+        Live faces are kept packed, max_vertices bounds both the live faces
+        (2V - 4) and a horizon (at most 3V edges)
+    */
+    u4 face_capacity = max_vertices * 5 + 8;
+    HullFace* faces = (HullFace*)alloc_transient(memory, sizeof(HullFace) * face_capacity);
+    b4* visible  = (b4*)alloc_transient(memory, sizeof(b4) * face_capacity);
+    u4* face_remap = (u4*)alloc_transient(memory, sizeof(u4) * face_capacity);
+    u4* horizon  = (u4*)alloc_transient(memory, sizeof(u4) * face_capacity * 6);
+    u4 face_count = 0;
+    if (!faces || !visible || !face_remap || !horizon)
+    {
+        release_transient(memory, start);
+        return false;
+    }
+
+    glm::vec3 inside = (points[a] + points[b] + points[c] + points[d]) * 0.25f;
+    u4 tetra[4][3] = { { a, b, c }, { a, c, d }, { a, d, b }, { b, d, c } };
+    for (u4 i = 0; i < 4; i++)
+    {
+        HullFace face = make_hull_face(points, tetra[i][0], tetra[i][1], tetra[i][2]);
+        if (hull_distance(face, inside) > 0.0f)
+        {
+            face = make_hull_face(points, tetra[i][0], tetra[i][2], tetra[i][1]);
+        }
+        faces[face_count++] = face;
+    }
+
+    /*
+        Outside sets: every point above some face, with that face and how
+        far above it is
+    */
+    u4* outside_point = (u4*)alloc_transient(memory, sizeof(u4) * (u8)point_count);
+    u4* outside_face  = (u4*)alloc_transient(memory, sizeof(u4) * (u8)point_count);
+    f4* outside_distance = (f4*)alloc_transient(memory, sizeof(f4) * (u8)point_count);
+    u4 outside_count = 0;
+    if (!outside_point || !outside_face || !outside_distance)
+    {
+        release_transient(memory, start);
+        return false;
+    }
+
+    for (u4 i = 0; i < point_count; i++)
+    {
+        for (u4 f = 0; f < face_count; f++)
+        {
+            f4 distance = hull_distance(faces[f], points[i]);
+            if (distance > epsilon)
+            {
+                outside_point[outside_count] = i;
+                outside_face[outside_count] = f;
+                outside_distance[outside_count] = distance;
+                outside_count++;
+                break;
+            }
+        }
+    }
+
+    u4 vertex_count = 4;
+    while (outside_count && vertex_count < max_vertices)
+    {
+        u4 farthest = 0;
+        for (u4 i = 1; i < outside_count; i++)
+        {
+            if (outside_distance[i] > outside_distance[farthest]) farthest = i;
+        }
+        u4 p = outside_point[farthest];
+        glm::vec3 eye = points[p];
+
+        /*
+            Faces p can see, and the horizon: their edges whose twin
+            belongs to a face p can't see
+        */
+        for (u4 f = 0; f < face_count; f++)
+        {
+            visible[f] = hull_distance(faces[f], eye) > epsilon;
+        }
+        visible[outside_face[farthest]] = true;
+
+        u4 horizon_count = 0;
+        for (u4 f = 0; f < face_count; f++)
+        {
+            if (!visible[f]) continue;
+            for (u4 k = 0; k < 3; k++)
+            {
+                u4 from = faces[f].v[k], to = faces[f].v[(k + 1) % 3];
+                b4 twin_visible = false;
+                for (u4 g = 0; g < face_count && !twin_visible; g++)
+                {
+                    if (!visible[g] || g == f) continue;
+                    for (u4 m = 0; m < 3; m++)
+                    {
+                        if (faces[g].v[m] == to && faces[g].v[(m + 1) % 3] == from) twin_visible = true;
+                    }
+                }
+                if (!twin_visible)
+                {
+                    horizon[horizon_count * 2 + 0] = from;
+                    horizon[horizon_count * 2 + 1] = to;
+                    horizon_count++;
+                }
+            }
+        }
+
+        u4 live = 0;
+        for (u4 f = 0; f < face_count; f++) live += !visible[f];
+        if (horizon_count < 3 || live + horizon_count > face_capacity) break; // numerically stuck
+
+        /*
+            Pack the faces that stay, then fan the horizon to p
+        */
+        u4 kept = 0;
+        for (u4 f = 0; f < face_count; f++)
+        {
+            face_remap[f] = visible[f] ? OBJ_NONE : kept;
+            if (!visible[f]) faces[kept++] = faces[f];
+        }
+        u4 first_new = kept;
+        for (u4 i = 0; i < horizon_count; i++)
+        {
+            faces[kept++] = make_hull_face(points, horizon[i * 2], horizon[i * 2 + 1], p);
+        }
+        face_count = kept;
+        vertex_count++;
+
+        /*
+            Points above a removed face move to a new face or are inside now
+        */
+        u4 remaining = 0;
+        for (u4 i = 0; i < outside_count; i++)
+        {
+            if (i == farthest) continue;
+            u4 f = face_remap[outside_face[i]];
+            if (f == OBJ_NONE)
+            {
+                glm::vec3 q = points[outside_point[i]];
+                for (u4 g = first_new; g < face_count; g++)
+                {
+                    f4 distance = hull_distance(faces[g], q);
+                    if (distance > epsilon)
+                    {
+                        f = g;
+                        outside_distance[i] = distance;
+                        break;
+                    }
+                }
+                if (f == OBJ_NONE) continue;
+            }
+            outside_point[remaining] = outside_point[i];
+            outside_face[remaining] = f;
+            outside_distance[remaining] = outside_distance[i];
+            remaining++;
+        }
+        outside_count = remaining;
+    }
+
+    /*
+        Compact the vertices the faces use
+    */
+    u4* vertex_remap = outside_face; // reused, outside sets are done
+    memset(vertex_remap, 0xFF, sizeof(u4) * (u8)point_count);
+    out.hull_index_count = face_count * 3;
+    out.hull_indices = (u4*)alloc(memory, sizeof(u4) * out.hull_index_count);
+    if (!out.hull_indices)
+    {
+        out.hull_index_count = 0;
+        release_transient(memory, start);
+        return false;
+    }
+    for (u4 f = 0; f < face_count; f++)
+    {
+        for (u4 k = 0; k < 3; k++)
+        {
+            u4 v = faces[f].v[k];
+            if (vertex_remap[v] == OBJ_NONE) vertex_remap[v] = out.hull_vertex_count++;
+            out.hull_indices[f * 3 + k] = vertex_remap[v];
+        }
+    }
+    out.hull_vertices = (glm::vec3*)alloc(memory, sizeof(glm::vec3) * out.hull_vertex_count);
+    if (!out.hull_vertices)
+    {
+        out.hull_indices = 0;
+        out.hull_index_count = 0;
+        out.hull_vertex_count = 0;
+        release_transient(memory, start);
+        return false;
+    }
+    for (u4 v = 0; v < point_count; v++)
+    {
+        if (vertex_remap[v] != OBJ_NONE) out.hull_vertices[vertex_remap[v]] = points[v];
+    }
+
+    release_transient(memory, start);
+    return true;
+}
+
+/*
+    Eberly's subexpressions for one coordinate of a triangle
+*/
+inline void mass_subexpressions(f8 w0, f8 w1, f8 w2, f8 &f1, f8 &f2, f8 &f3, f8 &g0, f8 &g1, f8 &g2)
+{
+    f8 temp0 = w0 + w1;
+    f1 = temp0 + w2;
+    f8 temp1 = w0 * w0;
+    f8 temp2 = temp1 + w1 * temp0;
+    f2 = temp2 + w2 * f1;
+    f3 = w0 * temp1 + w1 * temp2 + w2 * f2;
+    g0 = f2 + w0 * (f1 + w0);
+    g1 = f2 + w1 * (f1 + w1);
+    g2 = f2 + w2 * (f1 + w2);
+}
+
+/*
+    Mass properties at density 1 of the solid bounded by triangles.
+    False when the surface isn't closed (its area vectors don't cancel),
+    the answer would then depend on where the origin is.
+*/
+b4 compute_mass_properties(const glm::vec3* vertices, const u4* indices, u4 index_count,
+                           f4 &volume, glm::vec3 &center, f4 inertia[6])
+{
+    f8 integral[10] = {};
+    f8 area_sum[3] = {};
+    f8 area_total = 0.0;
+
+    for (u4 i = 0; i + 2 < index_count; i += 3)
+    {
+        glm::vec3 p0 = vertices[indices[i]], p1 = vertices[indices[i + 1]], p2 = vertices[indices[i + 2]];
+        f8 x0 = p0.x, y0 = p0.y, z0 = p0.z;
+        f8 x1 = p1.x, y1 = p1.y, z1 = p1.z;
+        f8 x2 = p2.x, y2 = p2.y, z2 = p2.z;
+
+        f8 a1 = x1 - x0, b1 = y1 - y0, c1 = z1 - z0;
+        f8 a2 = x2 - x0, b2 = y2 - y0, c2 = z2 - z0;
+        f8 d0 = b1 * c2 - b2 * c1;
+        f8 d1 = a2 * c1 - a1 * c2;
+        f8 d2 = a1 * b2 - a2 * b1;
+
+        area_sum[0] += d0;
+        area_sum[1] += d1;
+        area_sum[2] += d2;
+        area_total += sqrt(d0 * d0 + d1 * d1 + d2 * d2);
+
+        f8 f1x, f2x, f3x, g0x, g1x, g2x;
+        f8 f1y, f2y, f3y, g0y, g1y, g2y;
+        f8 f1z, f2z, f3z, g0z, g1z, g2z;
+        mass_subexpressions(x0, x1, x2, f1x, f2x, f3x, g0x, g1x, g2x);
+        mass_subexpressions(y0, y1, y2, f1y, f2y, f3y, g0y, g1y, g2y);
+        mass_subexpressions(z0, z1, z2, f1z, f2z, f3z, g0z, g1z, g2z);
+
+        integral[0] += d0 * f1x;
+        integral[1] += d0 * f2x;
+        integral[2] += d1 * f2y;
+        integral[3] += d2 * f2z;
+        integral[4] += d0 * f3x;
+        integral[5] += d1 * f3y;
+        integral[6] += d2 * f3z;
+        integral[7] += d0 * (y0 * g0x + y1 * g1x + y2 * g2x);
+        integral[8] += d1 * (z0 * g0y + z1 * g1y + z2 * g2y);
+        integral[9] += d2 * (x0 * g0z + x1 * g1z + x2 * g2z);
+    }
+
+    f8 open = sqrt(area_sum[0] * area_sum[0] + area_sum[1] * area_sum[1] + area_sum[2] * area_sum[2]);
+    if (area_total == 0.0 || open > area_total * 1e-4) return false;
+
+    const f8 scale[10] = { 1.0 / 6, 1.0 / 24, 1.0 / 24, 1.0 / 24, 1.0 / 60, 1.0 / 60, 1.0 / 60, 1.0 / 120, 1.0 / 120, 1.0 / 120 };
+    for (u4 i = 0; i < 10; i++) integral[i] *= scale[i];
+
+    // wound inside out
+    if (integral[0] < 0.0)
+    {
+        for (u4 i = 0; i < 10; i++) integral[i] = -integral[i];
+    }
+    if (integral[0] == 0.0) return false;
+
+    f8 mass = integral[0];
+    f8 cx = integral[1] / mass, cy = integral[2] / mass, cz = integral[3] / mass;
+
+    volume = (f4)mass;
+    center = glm::vec3((f4)cx, (f4)cy, (f4)cz);
+    inertia[0] = (f4)(integral[5] + integral[6] - mass * (cy * cy + cz * cz));
+    inertia[1] = (f4)(integral[4] + integral[6] - mass * (cz * cz + cx * cx));
+    inertia[2] = (f4)(integral[4] + integral[5] - mass * (cx * cx + cy * cy));
+    inertia[3] = (f4)-(integral[7] - mass * cx * cy);
+    inertia[4] = (f4)-(integral[8] - mass * cy * cz);
+    inertia[5] = (f4)-(integral[9] - mass * cz * cx);
+    return true;
+}
+
+void build_physics_shape(MeshData &mesh, GameMemory &memory, u4 max_hull_vertices = HULL_MAX_VERTICES)
+{
+    mesh.volume = 0.0f;
+    mesh.center_of_mass = glm::vec3(0.0f);
+    memset(mesh.inertia, 0, sizeof(mesh.inertia));
+
+    b4 has_hull = build_hull(mesh.vertices, mesh.vertex_count, max_hull_vertices, memory, mesh);
+
+    // the mesh if it is closed, else its hull, else a flat mesh keeps no volume
+    if (!compute_mass_properties(mesh.vertices, mesh.indices, mesh.lod_index_count[0],
+                                 mesh.volume, mesh.center_of_mass, mesh.inertia))
+    {
+        if (has_hull)
+        {
+            compute_mass_properties(mesh.hull_vertices, mesh.hull_indices, mesh.hull_index_count,
+                                    mesh.volume, mesh.center_of_mass, mesh.inertia);
+        }
+    }
+}
@@ -14,29 +14,99 @@
     -2018
 */
 #include "vars.cpp"
+#include "glstate.cpp"
+#include "dynamicbuffer.cpp"
+#include "texturearray.cpp"
 #include "sgl.cpp"
+#include "streaming.cpp"
 #include "shaders.cpp"
+#include "hotreload.cpp"
 #include "render_functions.cpp"
 #include "physics.cpp"
 
+/*
+    --headless <frames> renders that many frames offscreen (see
+    create_headless_context) instead of opening a window. Every frame
+    steps physics once by PHYSICS_MS and the camera follows a fixed path,
+    so runs are comparable. Measured once the assets are loaded, then
+    reported: CPU time to submit a frame's draws, draw calls, GL state
+    calls issued and skipped by the cache, entities culled.
+*/
+struct HeadlessRun
+{
+    u4 frames; // 0 with a window
+    u4 frame;
+    f8* submit_ms;
+    u8 draws;
+    u8 issued;
+    u8 skipped;
+    u8 culled;
+} headless;
+
+int compare_ms(const void* a, const void* b)
+{
+    f8 x = *(const f8*)a;
+    f8 y = *(const f8*)b;
+    return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+void report_headless()
+{
+    u4 n = headless.frame;
+    if (!n) return;
+    qsort(headless.submit_ms, n, sizeof(f8), compare_ms);
+    f8 total = 0.0;
+    for (u4 i = 0; i < n; i++) total += headless.submit_ms[i];
+
+    printf("Headless: %u frames at %dx%d\n", n, sgl.width, sgl.height);
+    printf("  submit ms   min %.4f  median %.4f  mean %.4f  p95 %.4f  max %.4f\n",
+        headless.submit_ms[0], headless.submit_ms[n / 2], total / n,
+        headless.submit_ms[(u4)((n - 1) * 0.95)], headless.submit_ms[n - 1]);
+    printf("  per frame   %.2f draws  %.2f GL state calls issued  %.2f skipped  %.2f entities culled\n",
+        (f8)headless.draws / n, (f8)headless.issued / n, (f8)headless.skipped / n, (f8)headless.culled / n);
+}
+
 int main(int argc, char* argv[])
 {
-    initialize_memory(memory, 8, 2);
-    
-    if (!create_sdl_opengl_window()) 
+    // synchronous loads, and meshes too big for a streaming worker, parse into these too
+    initialize_memory(memory, 128, 512);
+
+    for (s4 i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0 && i + 1 < argc) headless.frames = (u4)atoi(argv[++i]);
+    }
+
+    if (headless.frames)
+    {
+        if (!create_headless_context(800, 600)) return 1;
+        headless.submit_ms = (f8*)malloc(sizeof(f8) * headless.frames);
+    }
+    else if (!create_sdl_opengl_window()) 
     {
         cout << "ERROR: failed to create sdl or opengl" << endl;
     }
 
     if (!create_basic_texture_shader()) return 0;
 
-    library.textures = (Library::Texture*)alloc(memory, sizeof(Library::Texture) * 20);
-    library.meshes = (Library::Mesh*)alloc(memory, sizeof(Library::Mesh) * 20);
+    library.texture_capacity = 20;
+    library.mesh_capacity = 20;
+    library.textures = (Library::Texture*)alloc(memory, sizeof(Library::Texture) * library.texture_capacity);
+    library.meshes = (Library::Mesh*)alloc(memory, sizeof(Library::Mesh) * library.mesh_capacity);
+    init_handles(handles, memory, 1024, 40);
 
-    load_texture("media/steel.png", 1024, 1024, 3);
-    load_texture("media/aluminum.png", 1024, 1024, 3);
-    load_mesh("media/tamanegi.obj");
-    load_mesh("media/cube.obj");
+    if (!open_pack(asset_pack, PACK_PATH))
+    {
+        cout << "No asset pack, loading assets one by one" << endl;
+    }
+
+    // handles are usable right away, entities show up once their assets are uploaded
+    start_streaming();
+    if (!headless.frames) start_hot_reload();
+    load_mesh("media/tamanegi.obj"); // its hull is needed for Garlic's body right away
+    request_texture("media/steel.png");
+    request_texture("media/aluminum.png");
+    request_mesh("media/tamanegi.obj");
+    request_mesh("media/cube.obj");
 
     /*
         Entities
@@ -54,18 +124,23 @@ int main(int argc, char* argv[])
         info.height = info.radius;
         info.depth = info.radius;
     init_body(Ball.body, info);
+    register_entity(Ball);
 
     Entity Garlic;
         Garlic.mesh = get_mesh("media/tamanegi.obj");
         Garlic.texture = get_texture("media/aluminum.png");
         info.pos = setv(0.0f,-5.0f,0.0f);
         info.dynamic = true;
-        info.type = TYPE_SPHERE;
+        info.type = TYPE_MESH;
         info.radius = 1.0f;
         info.width = info.radius;
         info.height = info.radius;
         info.depth = info.radius;
+        info.shape = lookup_mesh(Garlic.mesh) ? &lookup_mesh(Garlic.mesh)->data : 0;
+        if (!info.shape || !info.shape->hull_vertex_count) info.type = TYPE_SPHERE;
     init_body(Garlic.body, info);
+    info.shape = 0;
+    register_entity(Garlic);
 
     Entity Cuboid;
         Cuboid.mesh = get_mesh("media/cube.obj");
@@ -77,6 +152,7 @@ int main(int argc, char* argv[])
         info.height = 10.0f;
         info.depth = .05f;
     init_body(Cuboid.body, info);
+    register_entity(Cuboid);
 
     build_planes_from_cuboid(Cuboid.body);
 
@@ -91,6 +167,19 @@ int main(int argc, char* argv[])
     vec3 prev_camera_pos;
     vec3 camera_pos;
     vec3 camera_pos_on_radius;
+    u4 textures_packed = 0;
+
+    // measure the loaded scene, not the streaming
+    if (headless.frames)
+    {
+        while (!streaming_idle())
+        {
+            process_uploads(UPLOAD_BUDGET);
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        pack_textures();
+        textures_packed = texture_uploads;
+    }
 
     while(!key.quit_app)
     {
@@ -104,7 +193,20 @@ int main(int argc, char* argv[])
 
         // frame_time *= 0.15f;
 
-        poll_events();
+        // one physics step and one render a frame
+        if (headless.frames) frame_time = PHYSICS_MS;
+
+        if (!headless.frames) poll_events();
+
+        poll_hot_reload();
+        process_uploads(UPLOAD_BUDGET);
+
+        // once loading settles, merge same sized textures so they share one binding
+        if (streaming_idle() && texture_uploads != textures_packed)
+        {
+            pack_textures();
+            textures_packed = texture_uploads;
+        }
 
         physics_dt += frame_time;
         while (physics_dt >= PHYSICS_MS)
@@ -129,6 +231,14 @@ int main(int argc, char* argv[])
                 cam_radius += PI * 0.5f;
             }
 
+            if (headless.frames)
+            {
+                // one orbit over the run, moving in and out twice
+                f4 t = (f4)headless.frame / (f4)headless.frames;
+                camera_angle = t * PI * 2.0f;
+                cam_radius = 20.0f + 12.0f * sinf(t * PI * 4.0f);
+            }
+
             prev_camera_pos = camera_pos;
             camera_pos = weighted_average(camera_pos, camera_pos, 20.0f);
 
@@ -219,7 +329,7 @@ int main(int argc, char* argv[])
 
             glm::mat4 projection = glm::perspective(45.0f, 1.0f*sgl.width/sgl.height, 0.1f, 100.0f);
 
-            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glBindFramebuffer(GL_FRAMEBUFFER, sgl.framebuffer);
             glClearColor(0.23f, 0.47f, 0.58f, 1.0f); 
             glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -242,21 +352,56 @@ int main(int argc, char* argv[])
                 {
                     state.world = lerp(entity.body.prev_pos, entity.body.pos, alpha);
                 }
+                // the body sits at the center of mass, the mesh at its origin
+                state.world = state.world - entity.body.center_of_mass * entity.body.orientation;
+
+                Library::Mesh* mesh = lookup_mesh(entity.mesh);
+                Library::Texture* texture = lookup_texture(entity.texture);
+                if (!mesh || !texture) return;
+
                 state.scale = setv(entity.body.width, entity.body.height, entity.body.depth);
-                state.texture = entity.texture;
+                state.texture = texture->id;
+                state.layer = texture->layer;
                 state.orient = entity.body.orientation;
-                render_mesh(state, library.meshes[entity.mesh]);
+                queue_draw(state, *mesh);
             };
 
+            auto submit_start = std::chrono::steady_clock::now();
+            begin_dynamic_frame(instance_stream);
+            begin_draws(view, projection, 1024);
             render(Ball);
             render(Garlic);
             render(Cuboid);
+            flush_draws();
+            end_dynamic_frame(instance_stream);
+            auto submit_end = std::chrono::steady_clock::now();
 
-            SDL_GL_SwapWindow(sgl.window);
+            if (headless.frames)
+            {
+                // the GPU finishes outside the measured part, so its backlog doesn't throttle the next frame
+                glFinish();
+                headless.submit_ms[headless.frame] = std::chrono::duration<f8, std::milli>(submit_end - submit_start).count();
+                headless.draws += gl_state.draws;
+                headless.issued += gl_state.issued;
+                headless.skipped += gl_state.skipped;
+                headless.culled += draw_queue.culled;
+                if (++headless.frame == headless.frames) key.quit_app = true;
+            }
+            else
+            {
+                SDL_GL_SwapWindow(sgl.window);
+            }
+            end_gl_state_frame();
         }
         memory.transient_current = 0;
     }
     
+    if (headless.frames) report_headless();
+    free(headless.submit_ms);
+
+    stop_hot_reload();
+    stop_streaming();
+
     // Texture data
     for (u4 i = 0; i < library.texture_count; i++)
     {
@@ -266,12 +411,18 @@ int main(int argc, char* argv[])
     // Mesh data
     for (u4 i = 0; i < library.mesh_count; i++)
     {
+        if (vertex_arrays) glDeleteVertexArrays(1, &library.meshes[i].vertex_array);
         glDeleteBuffers(1, &library.meshes[i].vertex_buffer);
-        glDeleteBuffers(1, &library.meshes[i].uv_buffer);
+        glDeleteBuffers(1, &library.meshes[i].index_buffer);
+        free(library.meshes[i].hull_block);
     }
 
+    close_pack(asset_pack);
+
     // Shader
     glDeleteProgram(basic_texture.program);
+    if (instancing) glDeleteProgram(basic_texture_instanced.program);
+    destroy_dynamic_buffer(instance_stream);
     
     // Primitives
     glDeleteBuffers(1, &plane.verts);
@@ -279,7 +430,8 @@ int main(int argc, char* argv[])
     glDeleteBuffers(1, &plane.indices);
     glDeleteBuffers(1, &plane.uv_coords);
     
-    SDL_DestroyWindow( sgl.window );
+    destroy_headless_context();
+    if (sgl.window) SDL_DestroyWindow( sgl.window );
     SDL_Quit();
 
     free(memory.TransientStorage);
@@ -57,22 +57,58 @@ inline void empty_transient_soft(GameMemory &memory)
     memory.transient_current = 0;
 } 
 
-// Allocate permanent memory
+// Allocate permanent memory, 0 if it doesn't fit
 void* alloc(GameMemory &memory, uint64_t n)
 {
+    if (memory.current + n > memory.PermanentStorageSize)
+    {
+        #ifdef MEM_DEBUG
+            std::cout << "ERROR: Out of permanent memory." << std::endl;
+        #endif
+        return 0;
+    }
     memory.current += n;
     // cast to unsigned byte so i can increment it by single bytes
     return ( ((u1*)memory.PermanentStorage) + memory.current - n);
 } 
 
-// Allocate transient memory
+// Allocate transient memory, 0 if it doesn't fit
 void* alloc_transient(GameMemory &memory, std::size_t n)
 {
+    if (memory.transient_current + n > memory.TransientStorageSize)
+    {
+        #ifdef MEM_DEBUG
+            std::cout << "ERROR: Out of transient memory." << std::endl;
+        #endif
+        return 0;
+    }
     memory.transient_current += n;
     // std::cout << memory.transient_current << std::endl;
     return ( ((u1*)memory.TransientStorage) + memory.transient_current - n);
 }  
 
+inline uint64_t align16(uint64_t n) { return (n + 15) & ~(uint64_t)15; }
+
+// Copy a null terminated string into permanent memory
+char* alloc_string(GameMemory &memory, const char* s)
+{
+    uint64_t n = strlen(s) + 1;
+    char* r = (char*)alloc(memory, n);
+    if (r) memcpy(r, s, n);
+    return r;
+}
+
+/*
+    Marks let a loader hand back everything it allocated since the mark,
+    e.g. CPU copies of mesh data once they have been uploaded to the GPU.
+    Only valid while nothing else has been allocated after the mark.
+*/
+inline uint64_t permanent_mark(GameMemory &memory) { return memory.current; }
+inline uint64_t transient_mark(GameMemory &memory) { return memory.transient_current; }
+
+inline void release_permanent(GameMemory &memory, uint64_t mark) { memory.current = mark; }
+inline void release_transient(GameMemory &memory, uint64_t mark) { memory.transient_current = mark; }
+
 // Print out structure
 void check_storage(GameMemory &memory)
 {
@@ -98,7 +134,8 @@ void initialize_memory(GameMemory &memory, uint64_t num_megabytes, uint64_t tran
 {
     memory = {};
     memory.PermanentStorageSize = Megabytes((uint64_t)num_megabytes);// 9 * 1024 * 1024;
-    memory.PermanentStorage = malloc(memory.PermanentStorageSize);
+    // calloc'd, pages only get committed once something is allocated in them
+    memory.PermanentStorage = calloc(memory.PermanentStorageSize, 1);
     #ifdef MEM_DEBUG
         if (memory.PermanentStorage)
         {
@@ -110,12 +147,10 @@ void initialize_memory(GameMemory &memory, uint64_t num_megabytes, uint64_t tran
     
     memory.current = 0;
     memory.isInitialized = true;
-    memset(memory.PermanentStorage,0,memory.PermanentStorageSize); 
     
     memory.TransientStorageSize = Megabytes((uint64_t)trans_megabytes);
-    memory.TransientStorage = malloc(memory.TransientStorageSize);
+    memory.TransientStorage = calloc(memory.TransientStorageSize, 1);
     memory.transient_current = 0; 
-    memset(memory.TransientStorage,0,memory.TransientStorageSize);  
 }
 
 #endif // _GAME_MEMORY_H_
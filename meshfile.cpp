@@ -0,0 +1,315 @@
+/*
+    Binary mesh files
+
+    Written the first time an OBJ is parsed, next to it as <name>.obj.mesh.
+    Later runs map the file and point MeshData straight into the mapping,
+    so the GPU upload reads from the page cache and nothing is parsed.
+
+    Layout: MeshFileHeader, then each array at a 16 byte aligned offset.
+    Offsets are from the start of the file. Everything is stored in the
+    byte order of the machine that wrote it.
+
+    The cache is stale when the version changes or when the source's
+    mtime/size differ AND its contents no longer hash the same.
+*/
+
+#define MESH_FILE_MAGIC 0x4853454Du // "MESH"
+#define MESH_FILE_VERSION 4 // 2: triangles and vertices in cache order, 3: levels of detail, 4: hull and mass
+
+enum MESH_ATTRIBUTES {
+    MESH_POSITION = 1 << 0, // 3 x f4
+    MESH_UV       = 1 << 1, // 2 x f4
+    MESH_NORMAL   = 1 << 2, // 3 x f4
+};
+
+struct MeshFileHeader
+{
+    u4 magic;
+    u4 version;
+
+    // source OBJ this was built from
+    u8 source_mtime;
+    u8 source_size;
+    u8 source_hash;
+
+    u4 attributes;
+    u4 vertex_count;
+    u4 index_count;
+    u4 index_size;
+
+    // levels are back to back in the index array
+    u4 lod_count;
+    u4 lod_index_count[MESH_MAX_LODS];
+    f4 lod_error[MESH_MAX_LODS];
+
+    f4 bounds_min[3];
+    f4 bounds_max[3];
+
+    // physics, see hull.cpp
+    u4 hull_vertex_count;
+    u4 hull_index_count;
+    f4 volume;
+    f4 center_of_mass[3];
+    f4 inertia[6];
+
+    u8 vertices_offset;
+    u8 uvs_offset;
+    u8 normals_offset;
+    u8 indices_offset;
+    u8 hull_vertices_offset;
+    u8 hull_indices_offset;
+    u8 file_size;
+};
+
+void mesh_file_path(const char* source, char* out, u4 out_size)
+{
+    snprintf(out, out_size, "%s.mesh", source);
+}
+
+b4 write_mesh_file(const char* path, MeshData &mesh, AssetSource &source)
+{
+    MeshFileHeader header = {};
+    header.magic = MESH_FILE_MAGIC;
+    header.version = MESH_FILE_VERSION;
+    header.source_mtime = source.mtime;
+    header.source_size = source.size;
+    header.source_hash = source_hash(source);
+    header.attributes = MESH_POSITION | MESH_UV | MESH_NORMAL;
+    header.vertex_count = mesh.vertex_count;
+    header.index_count = mesh.index_count;
+    header.index_size = sizeof(u4);
+    header.lod_count = mesh.lod_count;
+    for (u4 lod = 0; lod < mesh.lod_count; lod++)
+    {
+        header.lod_index_count[lod] = mesh.lod_index_count[lod];
+        header.lod_error[lod] = mesh.lod_error[lod];
+    }
+    for (u4 k = 0; k < 3; k++)
+    {
+        header.bounds_min[k] = mesh.bounds_min[k];
+        header.bounds_max[k] = mesh.bounds_max[k];
+        header.center_of_mass[k] = mesh.center_of_mass[k];
+    }
+    header.hull_vertex_count = mesh.hull_vertex_count;
+    header.hull_index_count = mesh.hull_index_count;
+    header.volume = mesh.volume;
+    memcpy(header.inertia, mesh.inertia, sizeof(header.inertia));
+
+    u8 offset = align16(sizeof(MeshFileHeader));
+    header.vertices_offset = offset; offset = align16(offset + sizeof(glm::vec3) * (u8)mesh.vertex_count);
+    header.uvs_offset      = offset; offset = align16(offset + sizeof(glm::vec2) * (u8)mesh.vertex_count);
+    header.normals_offset  = offset; offset = align16(offset + sizeof(glm::vec3) * (u8)mesh.vertex_count);
+    header.indices_offset  = offset; offset = align16(offset + sizeof(u4) * (u8)mesh.index_count);
+    header.hull_vertices_offset = offset; offset = align16(offset + sizeof(glm::vec3) * (u8)mesh.hull_vertex_count);
+    header.hull_indices_offset  = offset; offset = offset + sizeof(u4) * (u8)mesh.hull_index_count;
+    header.file_size = offset;
+
+    /*
+        Write to a temporary and rename so a crash never leaves a half
+        written file that looks valid.
+    */
+    char temp[512];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE* file = fopen(temp, "wb");
+    if (!file) return false;
+
+    auto write_at = [file] (u8 offset, const void* data, u8 size)
+    {
+        static const u1 zeros[16] = {};
+        long at = ftell(file);
+        if (at < 0) return false;
+        if ((u8)at < offset) fwrite(zeros, 1, offset - (u8)at, file);
+        return size == 0 || fwrite(data, 1, size, file) == size;
+    };
+
+    b4 ok = write_at(0, &header, sizeof(header))
+         && write_at(header.vertices_offset, mesh.vertices, sizeof(glm::vec3) * (u8)mesh.vertex_count)
+         && write_at(header.uvs_offset,      mesh.uvs,      sizeof(glm::vec2) * (u8)mesh.vertex_count)
+         && write_at(header.normals_offset,  mesh.normals,  sizeof(glm::vec3) * (u8)mesh.vertex_count)
+         && write_at(header.indices_offset,  mesh.indices,  sizeof(u4) * (u8)mesh.index_count)
+         && write_at(header.hull_vertices_offset, mesh.hull_vertices, sizeof(glm::vec3) * (u8)mesh.hull_vertex_count)
+         && write_at(header.hull_indices_offset,  mesh.hull_indices,  sizeof(u4) * (u8)mesh.hull_index_count);
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temp, path) != 0)
+    {
+        remove(temp);
+        return false;
+    }
+    return true;
+}
+
+/*
+    Points mesh into a mesh file that is already in memory (mapped on its
+    own or inside the asset pack). If source is given, the data is
+    rejected unless it was built from that source.
+*/
+b4 parse_mesh_file(const u1* data, u8 size, MeshData &mesh, AssetSource* source = 0)
+{
+    MeshFileHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+
+    b4 ok = header.magic == MESH_FILE_MAGIC
+         && header.version == MESH_FILE_VERSION
+         && header.file_size == size
+         && header.index_size == sizeof(u4)
+         && header.attributes == (MESH_POSITION | MESH_UV | MESH_NORMAL)
+         && header.vertices_offset + sizeof(glm::vec3) * (u8)header.vertex_count <= size
+         && header.uvs_offset      + sizeof(glm::vec2) * (u8)header.vertex_count <= size
+         && header.normals_offset  + sizeof(glm::vec3) * (u8)header.vertex_count <= size
+         && header.indices_offset  + sizeof(u4) * (u8)header.index_count <= size
+         && header.hull_vertices_offset + sizeof(glm::vec3) * (u8)header.hull_vertex_count <= size
+         && header.hull_indices_offset  + sizeof(u4) * (u8)header.hull_index_count <= size;
+
+    u8 lod_indices = 0;
+    for (u4 lod = 0; ok && lod < header.lod_count; lod++) lod_indices += header.lod_index_count[lod];
+    ok = ok && header.lod_count >= 1 && header.lod_count <= MESH_MAX_LODS && lod_indices == header.index_count;
+
+    if (ok && source)
+    {
+        if (header.source_mtime != source->mtime || header.source_size != source->size)
+        {
+            // touched, but maybe not changed
+            ok = header.source_hash == source_hash(*source);
+        }
+    }
+    if (!ok) return false;
+
+    mesh = {};
+    mesh.vertex_count = header.vertex_count;
+    mesh.index_count  = header.index_count;
+    mesh.vertices = (glm::vec3*)(data + header.vertices_offset);
+    mesh.uvs      = (glm::vec2*)(data + header.uvs_offset);
+    mesh.normals  = (glm::vec3*)(data + header.normals_offset);
+    mesh.indices  = (u4*)(data + header.indices_offset);
+    mesh.lod_count = header.lod_count;
+    for (u4 lod = 0, offset = 0; lod < header.lod_count; lod++)
+    {
+        mesh.lod_offset[lod] = offset;
+        mesh.lod_index_count[lod] = header.lod_index_count[lod];
+        mesh.lod_error[lod] = header.lod_error[lod];
+        offset += header.lod_index_count[lod];
+    }
+    mesh.bounds_min = glm::vec3(header.bounds_min[0], header.bounds_min[1], header.bounds_min[2]);
+    mesh.bounds_max = glm::vec3(header.bounds_max[0], header.bounds_max[1], header.bounds_max[2]);
+    mesh.hull_vertex_count = header.hull_vertex_count;
+    mesh.hull_index_count = header.hull_index_count;
+    mesh.hull_vertices = (glm::vec3*)(data + header.hull_vertices_offset);
+    mesh.hull_indices = (u4*)(data + header.hull_indices_offset);
+    mesh.volume = header.volume;
+    mesh.center_of_mass = glm::vec3(header.center_of_mass[0], header.center_of_mass[1], header.center_of_mass[2]);
+    memcpy(mesh.inertia, header.inertia, sizeof(mesh.inertia));
+    return true;
+}
+
+/*
+    Maps a mesh file and points mesh into the mapping. The mapping has to
+    stay open as long as mesh is used.
+*/
+b4 open_mesh_file(const char* path, MappedFile &file, MeshData &mesh, AssetSource* source = 0)
+{
+    if (!map_file(file, path)) return false;
+    if (!parse_mesh_file(file.data, file.size, mesh, source))
+    {
+        unmap_file(file);
+        return false;
+    }
+    return true;
+}
+
+// Without a hull bodies fall back to spheres
+inline void drop_hull(MeshData &mesh)
+{
+    mesh.hull_vertices = 0;
+    mesh.hull_indices = 0;
+    mesh.hull_vertex_count = 0;
+    mesh.hull_index_count = 0;
+}
+
+/*
+    Copies mesh arrays (e.g. from a mapping) into permanent memory. False,
+    and mesh untouched, if they don't fit. The hull isn't included, the
+    runtime keeps it separately, see keep_hull.
+*/
+b4 copy_mesh_data(GameMemory &memory, MeshData &mesh)
+{
+    glm::vec3* vertices = (glm::vec3*)alloc(memory, sizeof(glm::vec3) * (u8)mesh.vertex_count);
+    glm::vec2* uvs      = (glm::vec2*)alloc(memory, sizeof(glm::vec2) * (u8)mesh.vertex_count);
+    glm::vec3* normals  = (glm::vec3*)alloc(memory, sizeof(glm::vec3) * (u8)mesh.vertex_count);
+    u4* indices         = (u4*)alloc(memory, sizeof(u4) * (u8)mesh.index_count);
+    if (!vertices || !uvs || !normals || !indices) return false;
+    memcpy(vertices, mesh.vertices, sizeof(glm::vec3) * (u8)mesh.vertex_count);
+    memcpy(uvs,      mesh.uvs,      sizeof(glm::vec2) * (u8)mesh.vertex_count);
+    memcpy(normals,  mesh.normals,  sizeof(glm::vec3) * (u8)mesh.vertex_count);
+    memcpy(indices,  mesh.indices,  sizeof(u4) * (u8)mesh.index_count);
+    mesh.vertices = vertices;
+    mesh.uvs = uvs;
+    mesh.normals = normals;
+    mesh.indices = indices;
+    return true;
+}
+
+/*
+    Everything done to a freshly parsed OBJ before it is cached or baked
+*/
+void process_mesh(MeshData &mesh, GameMemory &memory)
+{
+    build_lods(mesh, memory);
+    optimize_mesh(mesh, memory);
+    build_physics_shape(mesh, memory);
+}
+
+/*
+    Looks in the asset pack, then for a baked file, then in the binary
+    cache. On a hit mesh points into the pack or into mapping, which the
+    caller unmaps once done with the data. On a miss the OBJ is parsed
+    into permanent memory, mapping stays empty, and the cache is written
+    for next time. parse_threads is loadOBJ's max_threads.
+*/
+b4 load_mesh_data(const char* filename, GameMemory &memory, MeshData &mesh, MappedFile &mapping, u4 parse_threads = 0)
+{
+    char bake_path[512];
+    baked_path(filename, ".mesh", bake_path, sizeof(bake_path));
+
+    char cache_path[512];
+    mesh_file_path(filename, cache_path, sizeof(cache_path));
+
+    const u1* packed;
+    u8 packed_size;
+    b4 in_pack = find_in_pack(asset_pack, filename, PACK_MESH, packed, packed_size);
+
+    // a shipped pack is trusted without touching the source at all
+    if (in_pack && !check_asset_sources && parse_mesh_file(packed, packed_size, mesh)) return true;
+
+    AssetSource source;
+    if (!get_asset_source(filename, source))
+    {
+        // shipped without the OBJ, trust whatever was baked or cached
+        return (in_pack && parse_mesh_file(packed, packed_size, mesh))
+            || open_mesh_file(bake_path, mapping, mesh)
+            || open_mesh_file(cache_path, mapping, mesh);
+    }
+
+    if (in_pack && parse_mesh_file(packed, packed_size, mesh, &source)) return true;
+
+    if (open_mesh_file(bake_path, mapping, mesh, &source)) return true;
+
+    if (open_mesh_file(cache_path, mapping, mesh, &source))
+    {
+        // source was touched but not changed, store the new mtime so it isn't hashed every run
+        if (source.hashed) write_mesh_file(cache_path, mesh, source);
+        return true;
+    }
+
+    cout << "No baked mesh for " << filename << ", run assetbake" << endl;
+
+    if (!loadOBJ(filename, memory, mesh, parse_threads)) return false;
+    process_mesh(mesh, memory);
+
+    if (!write_mesh_file(cache_path, mesh, source))
+    {
+        cout << "Failed to write mesh cache: " << cache_path << endl;
+    }
+    return true;
+}
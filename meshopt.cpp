@@ -0,0 +1,300 @@
+/*
+    Mesh optimization
+
+    Run on every freshly indexed mesh before it is cached or baked.
+
+    1. Triangle order for the post-transform vertex cache, Tom Forsyth's
+       "Linear-Speed Vertex Cache Optimisation":
+       https://tomforsyth1000.github.io/papers/fast_vert_cache_opt.html
+       Each vertex gets a score from its position in a simulated LRU cache
+       and from how many triangles still use it. Greedily emit the best
+       scoring triangle, only rescoring triangles that touch the cache.
+
+    2. Vertex order for fetch: renumber vertices in the order the new
+       index buffer first uses them, so vertex reads walk memory forwards.
+
+    A pass whose temporaries don't fit in transient memory leaves the
+    mesh as it is, the order is only ever an optimization.
+
+    ACMR (average cache miss ratio) is transformed vertices per triangle,
+    measured with a FIFO cache. 3.0 is every corner a miss, around 0.6 is
+    about as good as a regular grid gets. assetbake reports it per mesh.
+*/
+
+#define FORSYTH_CACHE_SIZE 32
+#define FORSYTH_MAX_VALENCE 32
+#define ACMR_CACHE_SIZE 16
+
+f4 mesh_acmr(const u4* indices, u4 index_count, u4 vertex_count, GameMemory &memory, u4 cache_size = ACMR_CACHE_SIZE)
+{
+    if (index_count < 3) return 0.0f;
+
+    uint64_t start = transient_mark(memory);
+
+    // timestamp of when each vertex entered the cache, in misses
+    u4* entered = (u4*)alloc_transient(memory, sizeof(u4) * (u8)vertex_count);
+    if (!entered) return 0.0f;
+    memset(entered, 0, sizeof(u4) * (u8)vertex_count);
+
+    u4 misses = 0;
+    for (u4 i = 0; i < index_count; i++)
+    {
+        u4 v = indices[i];
+        if (entered[v] == 0 || misses - entered[v] >= cache_size)
+        {
+            misses++;
+            entered[v] = misses;
+        }
+    }
+
+    release_transient(memory, start);
+    return (f4)misses / (f4)(index_count / 3);
+}
+
+struct ForsythTables
+{
+    f4 cache[FORSYTH_CACHE_SIZE];
+    f4 valence[FORSYTH_MAX_VALENCE + 1];
+};
+
+void init_forsyth_tables(ForsythTables &tables)
+{
+    const f4 LAST_TRIANGLE_SCORE = 0.75f;
+    const f4 CACHE_DECAY_POWER = 1.5f;
+    const f4 VALENCE_BOOST_SCALE = 2.0f;
+    const f4 VALENCE_BOOST_POWER = 0.5f;
+
+    for (u4 i = 0; i < FORSYTH_CACHE_SIZE; i++)
+    {
+        if (i < 3)
+        {
+            // the last triangle's vertices, fixed so it doesn't matter which order it went out in
+            tables.cache[i] = LAST_TRIANGLE_SCORE;
+        }
+        else
+        {
+            f4 scaler = 1.0f - (f4)(i - 3) / (f4)(FORSYTH_CACHE_SIZE - 3);
+            tables.cache[i] = powf(scaler, CACHE_DECAY_POWER);
+        }
+    }
+
+    // favour vertices with few triangles left, to finish them off and avoid lone triangles later
+    tables.valence[0] = 0.0f;
+    for (u4 i = 1; i <= FORSYTH_MAX_VALENCE; i++)
+    {
+        tables.valence[i] = VALENCE_BOOST_SCALE * powf((f4)i, -VALENCE_BOOST_POWER);
+    }
+}
+
+inline f4 forsyth_vertex_score(ForsythTables &tables, s4 cache_position, u4 live_triangles)
+{
+    if (live_triangles == 0) return -1.0f; // nothing left to draw with it
+    f4 score = cache_position >= 0 ? tables.cache[cache_position] : 0.0f;
+    return score + tables.valence[live_triangles < FORSYTH_MAX_VALENCE ? live_triangles : FORSYTH_MAX_VALENCE];
+}
+
+/*
+    Reorders the triangles in indices in place. Temporaries are transient.
+*/
+void optimize_vertex_cache(u4* indices, u4 index_count, u4 vertex_count, GameMemory &memory)
+{
+    u4 triangle_count = index_count / 3;
+    if (triangle_count < 2) return;
+
+    uint64_t start = transient_mark(memory);
+
+    ForsythTables tables;
+    init_forsyth_tables(tables);
+
+    /*
+        Vertex -> triangle adjacency. Each vertex's live triangles are
+        adjacency[offset[v] .. offset[v] + live[v]], emitted ones get
+        swapped past the end.
+    */
+    u4* live     = (u4*)alloc_transient(memory, sizeof(u4) * (u8)vertex_count);
+    u4* offset   = (u4*)alloc_transient(memory, sizeof(u4) * (u8)vertex_count);
+    s4* position = (s4*)alloc_transient(memory, sizeof(s4) * (u8)vertex_count);
+    f4* vertex_score = (f4*)alloc_transient(memory, sizeof(f4) * (u8)vertex_count);
+    u4* adjacency = (u4*)alloc_transient(memory, sizeof(u4) * (u8)triangle_count * 3);
+    f4* triangle_score = (f4*)alloc_transient(memory, sizeof(f4) * (u8)triangle_count);
+    b4* emitted = (b4*)alloc_transient(memory, sizeof(b4) * (u8)triangle_count);
+    u4* output  = (u4*)alloc_transient(memory, sizeof(u4) * (u8)triangle_count * 3);
+    if (!live || !offset || !position || !vertex_score || !adjacency || !triangle_score || !emitted || !output)
+    {
+        release_transient(memory, start);
+        return;
+    }
+
+    memset(live, 0, sizeof(u4) * (u8)vertex_count);
+    for (u4 i = 0; i < triangle_count * 3; i++) live[indices[i]]++;
+
+    u4 sum = 0;
+    for (u4 v = 0; v < vertex_count; v++)
+    {
+        offset[v] = sum;
+        sum += live[v];
+        live[v] = 0;
+        position[v] = -1;
+    }
+    for (u4 t = 0; t < triangle_count; t++)
+    {
+        for (u4 k = 0; k < 3; k++)
+        {
+            u4 v = indices[t * 3 + k];
+            adjacency[offset[v] + live[v]++] = t;
+        }
+    }
+    for (u4 v = 0; v < vertex_count; v++)
+    {
+        vertex_score[v] = forsyth_vertex_score(tables, -1, live[v]);
+    }
+
+    u4 best = 0;
+    for (u4 t = 0; t < triangle_count; t++)
+    {
+        const u4* tri = indices + t * 3;
+        triangle_score[t] = vertex_score[tri[0]] + vertex_score[tri[1]] + vertex_score[tri[2]];
+        emitted[t] = false;
+        if (triangle_score[t] > triangle_score[best]) best = t;
+    }
+
+    // +3 for the triangle being pushed on before the tail falls off
+    u4 cache[FORSYTH_CACHE_SIZE + 3];
+    u4 cache_count = 0;
+    u4 next_unemitted = 0;
+
+    for (u4 out = 0; out < triangle_count; out++)
+    {
+        if (best == OBJ_NONE)
+        {
+            // dead end, nothing in the cache has triangles left: continue in input order
+            while (emitted[next_unemitted]) next_unemitted++;
+            best = next_unemitted;
+        }
+
+        const u4* tri = indices + best * 3;
+        memcpy(output + out * 3, tri, sizeof(u4) * 3);
+        emitted[best] = true;
+
+        /*
+            Retire the triangle from its vertices' lists, then move its
+            vertices to the front of the cache
+        */
+        u4 new_cache[FORSYTH_CACHE_SIZE + 3];
+        u4 new_count = 0;
+        for (u4 k = 0; k < 3; k++)
+        {
+            u4 v = tri[k];
+            u4* list = adjacency + offset[v];
+            for (u4 j = 0; j < live[v]; j++)
+            {
+                if (list[j] == best)
+                {
+                    list[j] = list[live[v] - 1];
+                    list[live[v] - 1] = best;
+                    live[v]--;
+                    break;
+                }
+            }
+            new_cache[new_count++] = v;
+        }
+        for (u4 i = 0; i < cache_count; i++)
+        {
+            u4 v = cache[i];
+            if (v != tri[0] && v != tri[1] && v != tri[2]) new_cache[new_count++] = v;
+        }
+
+        /*
+            Rescore everything that was or is in the cache, and the live
+            triangles around it
+        */
+        for (u4 i = 0; i < new_count; i++)
+        {
+            u4 v = new_cache[i];
+            position[v] = i < FORSYTH_CACHE_SIZE ? (s4)i : -1;
+            vertex_score[v] = forsyth_vertex_score(tables, position[v], live[v]);
+        }
+
+        best = OBJ_NONE;
+        f4 best_score = -1.0f;
+        for (u4 i = 0; i < new_count; i++)
+        {
+            u4 v = new_cache[i];
+            const u4* list = adjacency + offset[v];
+            for (u4 j = 0; j < live[v]; j++)
+            {
+                u4 t = list[j];
+                const u4* other = indices + t * 3;
+                triangle_score[t] = vertex_score[other[0]] + vertex_score[other[1]] + vertex_score[other[2]];
+                if (triangle_score[t] > best_score)
+                {
+                    best_score = triangle_score[t];
+                    best = t;
+                }
+            }
+        }
+
+        cache_count = new_count < FORSYTH_CACHE_SIZE ? new_count : FORSYTH_CACHE_SIZE;
+        memcpy(cache, new_cache, sizeof(u4) * cache_count);
+    }
+
+    memcpy(indices, output, sizeof(u4) * (u8)triangle_count * 3);
+    release_transient(memory, start);
+}
+
+/*
+    Renumbers vertices in order of first use and moves the vertex arrays
+    to match. Vertices no triangle uses end up at the back.
+*/
+void optimize_vertex_fetch(MeshData &mesh, GameMemory &memory)
+{
+    uint64_t start = transient_mark(memory);
+
+    u4* remap = (u4*)alloc_transient(memory, sizeof(u4) * (u8)mesh.vertex_count);
+    glm::vec3* vertices = (glm::vec3*)alloc_transient(memory, sizeof(glm::vec3) * (u8)mesh.vertex_count);
+    glm::vec2* uvs      = (glm::vec2*)alloc_transient(memory, sizeof(glm::vec2) * (u8)mesh.vertex_count);
+    glm::vec3* normals  = (glm::vec3*)alloc_transient(memory, sizeof(glm::vec3) * (u8)mesh.vertex_count);
+    if (!remap || !vertices || !uvs || !normals)
+    {
+        release_transient(memory, start);
+        return;
+    }
+    memset(remap, 0xFF, sizeof(u4) * (u8)mesh.vertex_count);
+
+    u4 next = 0;
+    for (u4 i = 0; i < mesh.index_count; i++)
+    {
+        u4 v = mesh.indices[i];
+        if (remap[v] == OBJ_NONE) remap[v] = next++;
+        mesh.indices[i] = remap[v];
+    }
+    for (u4 v = 0; v < mesh.vertex_count; v++)
+    {
+        if (remap[v] == OBJ_NONE) remap[v] = next++;
+    }
+
+    for (u4 v = 0; v < mesh.vertex_count; v++)
+    {
+        vertices[remap[v]] = mesh.vertices[v];
+        uvs[remap[v]]      = mesh.uvs[v];
+        normals[remap[v]]  = mesh.normals[v];
+    }
+    memcpy(mesh.vertices, vertices, sizeof(glm::vec3) * (u8)mesh.vertex_count);
+    memcpy(mesh.uvs, uvs, sizeof(glm::vec2) * (u8)mesh.vertex_count);
+    memcpy(mesh.normals, normals, sizeof(glm::vec3) * (u8)mesh.vertex_count);
+
+    release_transient(memory, start);
+}
+
+/*
+    Each level of detail is ordered on its own. Vertices follow level 0,
+    which uses all of them.
+*/
+void optimize_mesh(MeshData &mesh, GameMemory &memory)
+{
+    for (u4 lod = 0; lod < mesh.lod_count; lod++)
+    {
+        optimize_vertex_cache(mesh.indices + mesh.lod_offset[lod], mesh.lod_index_count[lod], mesh.vertex_count, memory);
+    }
+    optimize_vertex_fetch(mesh, memory);
+}
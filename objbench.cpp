@@ -0,0 +1,125 @@
+/*
+    OBJ parser benchmark
+
+    Parses an OBJ (media/rabbit.obj by default) and a synthetic 1M
+    triangle grid (written to /tmp on first run) single threaded and with
+    more threads (every hardware thread by default), and reports the best
+    of several runs in MB/s.
+
+    g++ objbench.cpp -O2 -std=c++11 -pthread -o objbench && ./objbench [file.obj] [threads]
+*/
+#include <iostream>
+#include <stdio.h>
+#include <cstring>
+#include <thread>
+#include <chrono>
+
+#include <glm/glm.hpp>
+
+#include "memory.h"
+#include "file_map.h"
+
+using namespace std;
+
+#include "objectloader.cpp"
+
+const char* SYNTHETIC_PATH = "/tmp/objbench_1m.obj";
+
+b4 write_synthetic_obj(const char* path, u4 quads_x, u4 quads_y)
+{
+    FILE* file = fopen(path, "w");
+    if (!file) return false;
+
+    fprintf(file, "# synthetic grid, %u triangles\n", quads_x * quads_y * 2);
+    for (u4 y = 0; y <= quads_y; y++)
+    for (u4 x = 0; x <= quads_x; x++)
+    {
+        fprintf(file, "v %f %f %f\n", x * 0.01f, y * 0.01f, sinf(x * 0.1f) * cosf(y * 0.1f));
+    }
+    for (u4 y = 0; y <= quads_y; y++)
+    for (u4 x = 0; x <= quads_x; x++)
+    {
+        fprintf(file, "vt %f %f\n", (f4)x / quads_x, (f4)y / quads_y);
+    }
+    for (u4 y = 0; y <= quads_y; y++)
+    for (u4 x = 0; x <= quads_x; x++)
+    {
+        fprintf(file, "vn %f %f %f\n", 0.0f, 0.0f, 1.0f);
+    }
+    u4 stride = quads_x + 1;
+    for (u4 y = 0; y < quads_y; y++)
+    for (u4 x = 0; x < quads_x; x++)
+    {
+        u4 a = y * stride + x + 1;
+        u4 b = a + 1;
+        u4 c = a + stride;
+        u4 d = c + 1;
+        fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a,a,a, b,b,b, d,d,d);
+        fprintf(file, "f %u/%u/%u %u/%u/%u %u/%u/%u\n", a,a,a, d,d,d, c,c,c);
+    }
+    fclose(file);
+    return true;
+}
+
+void bench(const char* path, u4 threads, u4 runs)
+{
+    MappedFile file;
+    if (!map_file(file, path))
+    {
+        cout << "Failed to map " << path << endl;
+        return;
+    }
+
+    f8 best = 1e30;
+    ObjData obj = {};
+    for (u4 i = 0; i < runs; i++)
+    {
+        uint64_t start_mark = transient_mark(memory);
+        auto start = chrono::high_resolution_clock::now();
+        b4 ok = parse_obj((const char*)file.data, file.size, memory, obj, threads);
+        auto end = chrono::high_resolution_clock::now();
+        release_transient(memory, start_mark);
+
+        if (!ok)
+        {
+            cout << "Failed to parse " << path << endl;
+            break;
+        }
+        f8 seconds = chrono::duration<f8>(end - start).count();
+        if (seconds < best) best = seconds;
+    }
+
+    f8 mb = file.size / (1024.0 * 1024.0);
+    printf("%-24s %2u thread(s) %8.2f MB %10.3f ms %10.1f MB/s  (%u tris)\n",
+        path, threads, mb, best * 1000.0, mb / best, obj.corner_count / 3);
+
+    unmap_file(file);
+}
+
+int main(int argc, char* argv[])
+{
+    initialize_memory(memory, 8, 256);
+
+    FILE* existing = fopen(SYNTHETIC_PATH, "r");
+    if (existing)
+    {
+        fclose(existing);
+    }
+    else
+    {
+        cout << "Writing " << SYNTHETIC_PATH << "..." << endl;
+        if (!write_synthetic_obj(SYNTHETIC_PATH, 1000, 500)) return 1;
+    }
+
+    const char* path = argc > 1 ? argv[1] : "media/rabbit.obj";
+    u4 all = argc > 2 ? (u4)atoi(argv[2]) : thread::hardware_concurrency();
+    if (all == 0) all = 1;
+
+    bench(path, 1, 50);
+    bench(SYNTHETIC_PATH, 1, 5);
+    if (all > 1) bench(SYNTHETIC_PATH, all, 5);
+
+    free(memory.TransientStorage);
+    free(memory.PermanentStorage);
+    return 0;
+}
@@ -3,7 +3,7 @@
 */
 
 // Very, VERY simple OBJ loader.
-// Here is a short list of features a real function would provide : 
+// Here is a short list of features a real function would provide :
 // - Binary files. Reading a model should be just a few memcpy's away, not parsing a file at runtime. In short : OBJ is not very great.
 // - Animations & bones (includes bones weights)
 // - Multiple UVs
@@ -12,94 +12,552 @@
 // - More secure. Change another line and you can inject code.
 // - Loading from memory, stream, etc
 
+/*
+    The file is mapped and scanned twice: once to count elements so every
+    array can be allocated exactly, once to fill them. Large files are cut
+    into chunks at line boundaries and both passes run on each chunk in
+    parallel. A prefix sum over the chunk counts tells every chunk where
+    its output starts, and where relative (negative) face indices point.
+
+    Supports v, vt, vn and f with v, v/t, v//n or v/t/n corners. Polygons
+    are triangulated as fans. Everything else is skipped.
+*/
+
+#define OBJ_NONE 0xFFFFFFFFu
+#define OBJ_MAX_CHUNKS 32
+#define OBJ_MIN_CHUNK_SIZE Megabytes(1)
+
+struct ObjData
+{
+    glm::vec3* positions;
+    glm::vec2* uvs;
+    glm::vec3* normals;
+    u4 position_count;
+    u4 uv_count;
+    u4 normal_count;
+
+    // 3 per triangle corner: position, uv, normal. 0 based, OBJ_NONE when absent.
+    u4* corners;
+    u4 corner_count;
+};
+
+struct ObjChunk
+{
+    const char* begin;
+    const char* end;
+
+    u4 position_count, uv_count, normal_count, corner_count;
+    u4 position_base, uv_base, normal_base, corner_base;
+    b4 error;
+};
+
+/*
+    Number parsing. Hand written since fscanf/strtof go through the locale
+    machinery and were most of the time spent on a large file.
+*/
+static const f8 obj_pow10[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+inline b4 obj_is_digit(char c) { return (u1)(c - '0') < 10; }
+
+inline const char* obj_skip_space(const char* p, const char* end)
+{
+    while (p < end && (*p == ' ' || *p == '\t')) p++;
+    return p;
+}
+
+inline const char* obj_parse_float(const char* p, const char* end, f4 &out)
+{
+    p = obj_skip_space(p, end);
+
+    b4 negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    // up to 19 significant digits fit in a u8, the rest only move the exponent
+    u8 mantissa = 0;
+    s4 exponent = 0;
+    u4 digits = 0;
+    while (p < end && obj_is_digit(*p))
+    {
+        if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); digits += mantissa != 0; }
+        else exponent++;
+        p++;
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && obj_is_digit(*p))
+        {
+            if (digits < 19) { mantissa = mantissa * 10 + (*p - '0'); digits += mantissa != 0; exponent--; }
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        b4 negative_exponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negative_exponent = *p == '-';
+            p++;
+        }
+        s4 e = 0;
+        while (p < end && obj_is_digit(*p))
+        {
+            if (e < 10000) e = e * 10 + (*p - '0');
+            p++;
+        }
+        exponent += negative_exponent ? -e : e;
+    }
+
+    f8 value = (f8)mantissa;
+    if (exponent < 0)
+    {
+        while (exponent < -22 && value != 0.0) { value /= 1e22; exponent += 22; }
+        if (exponent < -22) exponent = -22;
+        value /= obj_pow10[-exponent];
+    }
+    else
+    {
+        while (exponent > 22 && value != 0.0) { value *= 1e22; exponent -= 22; }
+        if (exponent > 22) exponent = 22;
+        value *= obj_pow10[exponent];
+    }
+
+    out = (f4)(negative ? -value : value);
+    return p;
+}
+
+inline const char* obj_parse_index(const char* p, const char* end, s4 &out)
+{
+    b4 negative = false;
+    if (p < end && *p == '-')
+    {
+        negative = true;
+        p++;
+    }
+    s4 value = 0;
+    while (p < end && obj_is_digit(*p))
+    {
+        value = value * 10 + (*p - '0');
+        p++;
+    }
+    out = negative ? -value : value;
+    return p;
+}
+
+// 1 based, negative is relative to the end of the list so far, 0 is absent
+inline u4 obj_resolve_index(s4 index, u4 count_so_far, u4 total, b4 &error)
+{
+    if (index == 0) return OBJ_NONE;
+    s8 r = index > 0 ? (s8)index - 1 : (s8)count_so_far + index;
+    if (r < 0 || r >= (s8)total)
+    {
+        error = true;
+        return OBJ_NONE;
+    }
+    return (u4)r;
+}
+
+inline const char* obj_line_end(const char* p, const char* end)
+{
+    const char* eol = (const char*)memchr(p, '\n', end - p);
+    return eol ? eol : end;
+}
+
+void obj_count_chunk(ObjChunk &chunk)
+{
+    const char* p = chunk.begin;
+    const char* end = chunk.end;
+
+    while (p < end)
+    {
+        const char* eol = obj_line_end(p, end);
+        if (eol - p >= 2)
+        {
+            if (p[0] == 'v')
+            {
+                if      (p[1] == ' ' || p[1] == '\t') chunk.position_count++;
+                else if (p[1] == 't')                 chunk.uv_count++;
+                else if (p[1] == 'n')                 chunk.normal_count++;
+            }
+            else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                u4 n = 0;
+                const char* q = p + 1;
+                while (q < eol)
+                {
+                    q = obj_skip_space(q, eol);
+                    if (q >= eol || *q == '\r') break;
+                    n++;
+                    while (q < eol && *q != ' ' && *q != '\t' && *q != '\r') q++;
+                }
+                if (n >= 3) chunk.corner_count += (n - 2) * 3;
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+void obj_fill_chunk(ObjChunk &chunk, ObjData &out)
+{
+    const char* p = chunk.begin;
+    const char* end = chunk.end;
+
+    u4 v = chunk.position_base;
+    u4 t = chunk.uv_base;
+    u4 n = chunk.normal_base;
+    u4* corner = out.corners + (u8)chunk.corner_base * 3;
+
+    while (p < end)
+    {
+        const char* eol = obj_line_end(p, end);
+        if (eol - p >= 2)
+        {
+            if (p[0] == 'v' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                glm::vec3 &vertex = out.positions[v++];
+                const char* q = obj_parse_float(p + 2, eol, vertex.x);
+                q = obj_parse_float(q, eol, vertex.y);
+                obj_parse_float(q, eol, vertex.z);
+            }
+            else if (p[0] == 'v' && p[1] == 't')
+            {
+                glm::vec2 &uv = out.uvs[t++];
+                const char* q = obj_parse_float(p + 2, eol, uv.x);
+                obj_parse_float(q, eol, uv.y);
+                uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
+            }
+            else if (p[0] == 'v' && p[1] == 'n')
+            {
+                glm::vec3 &normal = out.normals[n++];
+                const char* q = obj_parse_float(p + 2, eol, normal.x);
+                q = obj_parse_float(q, eol, normal.y);
+                obj_parse_float(q, eol, normal.z);
+            }
+            else if (p[0] == 'f' && (p[1] == ' ' || p[1] == '\t'))
+            {
+                u4 first[3], prev[3];
+                u4 count = 0;
+                const char* q = p + 1;
+                while (q < eol)
+                {
+                    q = obj_skip_space(q, eol);
+                    if (q >= eol || *q == '\r') break;
+
+                    s4 iv = 0, it = 0, in = 0;
+                    q = obj_parse_index(q, eol, iv);
+                    if (q < eol && *q == '/')
+                    {
+                        q = obj_parse_index(q + 1, eol, it);
+                        if (q < eol && *q == '/') q = obj_parse_index(q + 1, eol, in);
+                    }
+                    while (q < eol && *q != ' ' && *q != '\t' && *q != '\r') q++;
+
+                    u4 c[3];
+                    c[0] = obj_resolve_index(iv, v, out.position_count, chunk.error);
+                    c[1] = obj_resolve_index(it, t, out.uv_count, chunk.error);
+                    c[2] = obj_resolve_index(in, n, out.normal_count, chunk.error);
+                    if (c[0] == OBJ_NONE) chunk.error = true;
+
+                    if (count == 0)
+                    {
+                        memcpy(first, c, sizeof(c));
+                    }
+                    else if (count >= 2)
+                    {
+                        memcpy(corner + 0, first, sizeof(c));
+                        memcpy(corner + 3, prev, sizeof(c));
+                        memcpy(corner + 6, c, sizeof(c));
+                        corner += 9;
+                    }
+                    memcpy(prev, c, sizeof(c));
+                    count++;
+                }
+            }
+        }
+        p = eol + 1;
+    }
+}
+
+/*
+    Parses the OBJ text in data. Output arrays are allocated from transient
+    memory, the caller releases them. False if the file is malformed or
+    doesn't fit in memory.
+*/
+b4 parse_obj(const char* data, u8 size, GameMemory &memory, ObjData &out, u4 max_threads = 0)
+{
+    out = {};
+
+    /*
+        Split into chunks at line boundaries
+    */
+    u4 num_chunk = 1;
+    if (max_threads == 0) max_threads = std::thread::hardware_concurrency();
+    if (max_threads > 1 && size >= OBJ_MIN_CHUNK_SIZE * 2)
+    {
+        num_chunk = (u4)(size / OBJ_MIN_CHUNK_SIZE);
+        if (num_chunk > max_threads) num_chunk = max_threads;
+        if (num_chunk > OBJ_MAX_CHUNKS) num_chunk = OBJ_MAX_CHUNKS;
+    }
+
+    ObjChunk chunks[OBJ_MAX_CHUNKS] = {};
+    const char* end = data + size;
+    const char* p = data;
+    for (u4 i = 0; i < num_chunk; i++)
+    {
+        chunks[i].begin = p;
+        if (i == num_chunk - 1)
+        {
+            p = end;
+        }
+        else
+        {
+            p = data + (size * (i + 1)) / num_chunk;
+            if (p < chunks[i].begin) p = chunks[i].begin;
+            p = obj_line_end(p, end);
+            if (p < end) p++;
+        }
+        chunks[i].end = p;
+    }
+
+    auto run = [&chunks, num_chunk] (void (*job)(ObjChunk&, ObjData&), ObjData &out)
+    {
+        std::thread workers[OBJ_MAX_CHUNKS];
+        for (u4 i = 1; i < num_chunk; i++)
+        {
+            workers[i] = std::thread(job, std::ref(chunks[i]), std::ref(out));
+        }
+        job(chunks[0], out);
+        for (u4 i = 1; i < num_chunk; i++)
+        {
+            workers[i].join();
+        }
+    };
+
+    /*
+        Count, then prefix sum so every chunk knows where its output goes
+    */
+    run([] (ObjChunk &chunk, ObjData &) { obj_count_chunk(chunk); }, out);
+
+    for (u4 i = 0; i < num_chunk; i++)
+    {
+        chunks[i].position_base = out.position_count;
+        chunks[i].uv_base       = out.uv_count;
+        chunks[i].normal_base   = out.normal_count;
+        chunks[i].corner_base   = out.corner_count;
+        out.position_count += chunks[i].position_count;
+        out.uv_count       += chunks[i].uv_count;
+        out.normal_count   += chunks[i].normal_count;
+        out.corner_count   += chunks[i].corner_count;
+    }
+
+    out.positions = (glm::vec3*)alloc_transient(memory, sizeof(glm::vec3) * out.position_count);
+    out.uvs       = (glm::vec2*)alloc_transient(memory, sizeof(glm::vec2) * out.uv_count);
+    out.normals   = (glm::vec3*)alloc_transient(memory, sizeof(glm::vec3) * out.normal_count);
+    out.corners   = (u4*)alloc_transient(memory, sizeof(u4) * 3 * (u8)out.corner_count);
+    if (!out.positions || !out.uvs || !out.normals || !out.corners) return false;
+
+    /*
+        Fill
+    */
+    run(obj_fill_chunk, out);
+
+    for (u4 i = 0; i < num_chunk; i++)
+    {
+        if (chunks[i].error) return false;
+    }
+    return true;
+}
+
+#define MESH_MAX_LODS 4
+
+/*
+    Indexed mesh, one vertex per unique position/uv/normal triple.
+
+    Levels of detail share the vertices and sit in indices back to back,
+    level 0 (the full mesh) first. index_count covers all levels.
+*/
+struct MeshData
+{
+    glm::vec3* vertices;
+    glm::vec2* uvs;
+    glm::vec3* normals;
+    u4 vertex_count;
+
+    u4* indices;
+    u4 index_count;
+
+    u4 lod_count;
+    u4 lod_offset[MESH_MAX_LODS];      // into indices
+    u4 lod_index_count[MESH_MAX_LODS];
+    f4 lod_error[MESH_MAX_LODS];       // how far, in mesh units, a level may be off the full mesh
+
+    glm::vec3 bounds_min;
+    glm::vec3 bounds_max;
+
+    // collision proxy and mass properties at density 1, see hull.cpp
+    glm::vec3* hull_vertices;
+    u4 hull_vertex_count;
+    u4* hull_indices;
+    u4 hull_index_count;
+    f4 volume;
+    glm::vec3 center_of_mass;
+    f4 inertia[6]; // about center_of_mass: xx yy zz xy yz xz
+};
+
+void compute_bounds(MeshData &mesh)
+{
+    mesh.bounds_min = mesh.vertex_count ? mesh.vertices[0] : glm::vec3(0.0f);
+    mesh.bounds_max = mesh.bounds_min;
+    for (u4 i = 1; i < mesh.vertex_count; i++)
+    {
+        glm::vec3 v = mesh.vertices[i];
+        for (u4 k = 0; k < 3; k++)
+        {
+            if (v[k] < mesh.bounds_min[k]) mesh.bounds_min[k] = v[k];
+            if (v[k] > mesh.bounds_max[k]) mesh.bounds_max[k] = v[k];
+        }
+    }
+}
+
+/*
+    Sphere around the AABB center, through the farthest vertex. Needs
+    the bounds and the vertices.
+*/
+void compute_bounding_sphere(MeshData &mesh, glm::vec3 &center, f4 &radius)
+{
+    center = (mesh.bounds_min + mesh.bounds_max) * 0.5f;
+    f4 farthest = 0.0f;
+    for (u4 i = 0; i < mesh.vertex_count; i++)
+    {
+        glm::vec3 d = mesh.vertices[i] - center;
+        f4 distance = d.x * d.x + d.y * d.y + d.z * d.z;
+        if (distance > farthest) farthest = distance;
+    }
+    radius = sqrtf(farthest);
+}
+
+inline u4 hash_corner(const u4* c)
+{
+    u4 h = c[0] * 0x9E3779B1u;
+    h = (h ^ (h >> 15)) + c[1] * 0x85EBCA77u;
+    h = (h ^ (h >> 13)) + c[2] * 0xC2B2AE3Du;
+    return h ^ (h >> 16);
+}
+
+/*
+    Temporaries live in transient memory and are released before
+    returning. The output lives in permanent memory, see load_mesh for
+    when it is handed back. On failure the caller releases whatever
+    permanent memory was taken.
+
+    Corners are hashed on their position/uv/normal triple so triangles
+    share vertices, and the index buffer refers to those. max_threads
+    goes to parse_obj, 0 for every hardware thread.
+*/
 bool loadOBJ(
-    const char * path, 
-    vector<glm::vec3> & out_vertices, 
-    vector<glm::vec2> & out_uvs,
-    vector<glm::vec3> & out_normals
+    const char * path,
+    GameMemory & memory,
+    MeshData & out,
+    u4 max_threads = 0
 ){
     printf("Loading OBJ file %s...\n", path);
+    out = {};
 
-    vector<unsigned int> vertexIndices, uvIndices, normalIndices;
-    vector<glm::vec3> temp_vertices; 
-    vector<glm::vec2> temp_uvs;
-    vector<glm::vec3> temp_normals;
-
-    FILE * file = fopen(path, "r");
-    if( file == NULL ){
+    MappedFile file;
+    if (!map_file(file, path)) {
         printf("Impossible to open the file ! Are you in the right path ? See Tutorial 1 for details\n");
-        getchar();
         return false;
     }
 
-    while( 1 ){
-
-        char lineHeader[128];
-        // read the first word of the line
-        int res = fscanf(file, "%s", lineHeader);
-        if (res == EOF)
-            break; // EOF = End Of File. Quit the loop.
-
-        // else : parse lineHeader
-        
-        if ( strcmp( lineHeader, "v" ) == 0 ){
-            glm::vec3 vertex;
-            fscanf(file, "%f %f %f\n", &vertex.x, &vertex.y, &vertex.z );
-            temp_vertices.push_back(vertex);
-        }else if ( strcmp( lineHeader, "vt" ) == 0 ){
-            glm::vec2 uv;
-            fscanf(file, "%f %f\n", &uv.x, &uv.y );
-            uv.y = -uv.y; // Invert V coordinate since we will only use DDS texture, which are inverted. Remove if you want to use TGA or BMP loaders.
-            temp_uvs.push_back(uv);
-        }else if ( strcmp( lineHeader, "vn" ) == 0 ){
-            glm::vec3 normal;
-            fscanf(file, "%f %f %f\n", &normal.x, &normal.y, &normal.z );
-            temp_normals.push_back(normal);
-        }else if ( strcmp( lineHeader, "f" ) == 0 ){
-            string vertex1, vertex2, vertex3;
-            unsigned int vertexIndex[3], uvIndex[3], normalIndex[3];
-            int matches = fscanf(file, "%d/%d/%d %d/%d/%d %d/%d/%d\n", &vertexIndex[0], &uvIndex[0], &normalIndex[0], &vertexIndex[1], &uvIndex[1], &normalIndex[1], &vertexIndex[2], &uvIndex[2], &normalIndex[2] );
-            if (matches != 9){
-                printf("File can't be read by our simple parser :-( Try exporting with other options\n");
-                fclose(file);
-                return false;
+    uint64_t transient_start = transient_mark(memory);
+
+    ObjData obj;
+    if (!parse_obj((const char*)file.data, file.size, memory, obj, max_threads))
+    {
+        printf("File can't be read by our simple parser :-( Try exporting with other options\n");
+        unmap_file(file);
+        release_transient(memory, transient_start);
+        return false;
+    }
+    unmap_file(file);
+
+    /*
+        Deduplicate corners. The table is kept at most half full.
+    */
+    u4 c = obj.corner_count;
+    u4 table_size = 16;
+    while (table_size < c * 2) table_size <<= 1;
+    u4 mask = table_size - 1;
+
+    u4* table  = (u4*)alloc_transient(memory, sizeof(u4) * table_size);
+    u4* unique = (u4*)alloc_transient(memory, sizeof(u4) * (u8)c); // first corner of each unique vertex
+    out.index_count = c;
+    out.indices = (u4*)alloc(memory, sizeof(u4) * c);
+    if (!table || !unique || !out.indices)
+    {
+        printf("Out of memory loading %s\n", path);
+        release_transient(memory, transient_start);
+        return false;
+    }
+    memset(table, 0xFF, sizeof(u4) * table_size);
+    out.lod_count = 1;
+    out.lod_index_count[0] = c;
+
+    u4 num_unique = 0;
+    for( u4 i=0; i<c; i++ ){
+        const u4* corner = obj.corners + (u8)i * 3;
+        u4 slot = hash_corner(corner) & mask;
+        while (1)
+        {
+            u4 v = table[slot];
+            if (v == OBJ_NONE)
+            {
+                table[slot] = num_unique;
+                unique[num_unique] = i;
+                out.indices[i] = num_unique++;
+                break;
             }
-            vertexIndices.push_back(vertexIndex[0]);
-            vertexIndices.push_back(vertexIndex[1]);
-            vertexIndices.push_back(vertexIndex[2]);
-            uvIndices    .push_back(uvIndex[0]);
-            uvIndices    .push_back(uvIndex[1]);
-            uvIndices    .push_back(uvIndex[2]);
-            normalIndices.push_back(normalIndex[0]);
-            normalIndices.push_back(normalIndex[1]);
-            normalIndices.push_back(normalIndex[2]);
-        }else{
-            // Probably a comment, eat up the rest of the line
-            char stupidBuffer[1000];
-            fgets(stupidBuffer, 1000, file);
+            const u4* other = obj.corners + (u8)unique[v] * 3;
+            if (other[0] == corner[0] && other[1] == corner[1] && other[2] == corner[2])
+            {
+                out.indices[i] = v;
+                break;
+            }
+            slot = (slot + 1) & mask;
         }
-
     }
 
-    // For each vertex of each triangle
-    for( unsigned int i=0; i<vertexIndices.size(); i++ ){
+    /*
+        Exactly sized vertex arrays
+    */
+    out.vertex_count = num_unique;
+    out.vertices = (glm::vec3*)alloc(memory, sizeof(glm::vec3) * num_unique);
+    out.uvs      = (glm::vec2*)alloc(memory, sizeof(glm::vec2) * num_unique);
+    out.normals  = (glm::vec3*)alloc(memory, sizeof(glm::vec3) * num_unique);
+    if (!out.vertices || !out.uvs || !out.normals)
+    {
+        printf("Out of memory loading %s\n", path);
+        release_transient(memory, transient_start);
+        return false;
+    }
 
-        // Get the indices of its attributes
-        unsigned int vertexIndex = vertexIndices[i];
-        unsigned int uvIndex = uvIndices[i];
-        unsigned int normalIndex = normalIndices[i];
-        
-        // Get the attributes thanks to the index
-        glm::vec3 vertex = temp_vertices[ vertexIndex-1 ];
-        glm::vec2 uv = temp_uvs[ uvIndex-1 ];
-        glm::vec3 normal = temp_normals[ normalIndex-1 ];
-        
-        // Put the attributes in buffers
-        out_vertices.push_back(vertex);
-        out_uvs     .push_back(uv);
-        out_normals .push_back(normal);
-    
+    for( u4 i=0; i<num_unique; i++ ){
+        const u4* corner = obj.corners + (u8)unique[i] * 3;
+        out.vertices[i] = obj.positions[ corner[0] ];
+        out.uvs[i]      = corner[1] != OBJ_NONE ? obj.uvs[ corner[1] ] : glm::vec2(0.0f, 0.0f);
+        out.normals[i]  = corner[2] != OBJ_NONE ? obj.normals[ corner[2] ] : glm::vec3(0.0f, 0.0f, 0.0f);
     }
-    fclose(file);
+
+    compute_bounds(out);
+
+    release_transient(memory, transient_start);
     return true;
-}
\ No newline at end of file
+}
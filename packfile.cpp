@@ -0,0 +1,213 @@
+/*
+    Asset pack
+
+    Every baked asset in one file, so startup costs one open and one mmap
+    instead of one per asset. That matters on network filesystems where
+    each open is a round trip.
+
+    Layout:
+        PackHeader
+        table of contents: open addressing hash table of PackEntry,
+            keyed on the hash of the source path (e.g. "media/steel.png")
+        the source paths themselves, NUL terminated, to confirm a hash hit
+        payloads, each starting on a 4K boundary
+
+    Payloads are the baked .mesh/.tex files byte for byte, so once the
+    pack is mapped a lookup is a hash probe and a pointer.
+*/
+
+#define PACK_FILE_MAGIC 0x4B434150u // "PACK"
+#define PACK_FILE_VERSION 2 // 2: entry names
+#define PACK_ALIGNMENT 4096
+#define PACK_PATH BAKED_DIR "/assets.pack"
+
+enum PACK_TYPES {
+    PACK_EMPTY = 0,
+    PACK_MESH,
+    PACK_TEXTURE,
+};
+
+struct PackHeader
+{
+    u4 magic;
+    u4 version;
+    u4 entry_count;
+    u4 toc_capacity; // power of two
+    u8 toc_offset;
+    u8 file_size;
+};
+
+struct PackEntry
+{
+    u8 name_hash;
+    u8 offset;
+    u8 size;
+    u8 name_offset;
+    u4 name_size; // without the NUL
+    u4 type;
+};
+
+struct AssetPack
+{
+    MappedFile file;
+    PackEntry* toc = 0;
+    u4 toc_capacity = 0;
+};
+
+global_variable AssetPack asset_pack;
+
+// packed assets are used as is, only hot reloading checks them against their sources
+global_variable b4 check_asset_sources = false;
+
+b4 open_pack(AssetPack &pack, const char* path)
+{
+    pack = {};
+    if (!map_file(pack.file, path)) return false;
+
+    PackHeader header;
+    b4 ok = pack.file.size >= sizeof(header);
+    if (ok)
+    {
+        memcpy(&header, pack.file.data, sizeof(header));
+        ok = header.magic == PACK_FILE_MAGIC
+          && header.version == PACK_FILE_VERSION
+          && header.file_size == pack.file.size
+          && header.toc_capacity
+          && (header.toc_capacity & (header.toc_capacity - 1)) == 0
+          && header.toc_offset + sizeof(PackEntry) * (u8)header.toc_capacity <= pack.file.size;
+    }
+    if (!ok)
+    {
+        cout << "Invalid asset pack: " << path << endl;
+        unmap_file(pack.file);
+        return false;
+    }
+
+    // lookups jump around the table and into payloads
+    madvise(pack.file.data, pack.file.size, MADV_RANDOM);
+
+    pack.toc = (PackEntry*)(pack.file.data + header.toc_offset);
+    pack.toc_capacity = header.toc_capacity;
+    return true;
+}
+
+void close_pack(AssetPack &pack)
+{
+    unmap_file(pack.file);
+    pack = {};
+}
+
+b4 find_in_pack(AssetPack &pack, const char* name, u4 type, const u1* &data, u8 &size)
+{
+    if (!pack.toc) return false;
+
+    u8 hash = hash_string(name);
+    u8 name_size = strlen(name);
+    u4 mask = pack.toc_capacity - 1;
+    for (u4 i = (u4)hash & mask, probe = 0; probe < pack.toc_capacity; i = (i + 1) & mask, probe++)
+    {
+        PackEntry &entry = pack.toc[i];
+        if (entry.type == PACK_EMPTY) return false;
+        if (entry.name_hash != hash || entry.type != type || entry.name_size != name_size) continue;
+
+        // a hash collision keeps probing
+        if (entry.name_offset + name_size > pack.file.size
+            || memcmp(pack.file.data + entry.name_offset, name, name_size) != 0) continue;
+
+        if (entry.offset + entry.size > pack.file.size) return false;
+        data = pack.file.data + entry.offset;
+        size = entry.size;
+        return true;
+    }
+    return false;
+}
+
+/*
+    Writer, used by assetbake. names[i] is what the runtime will look up,
+    paths[i] is the baked file to copy in.
+*/
+b4 write_pack(const char* path, const char** names, const char** paths, const u4* types, u4 count)
+{
+    PackHeader header = {};
+    header.magic = PACK_FILE_MAGIC;
+    header.version = PACK_FILE_VERSION;
+    header.entry_count = count;
+    header.toc_capacity = 16;
+    while (header.toc_capacity < count * 2) header.toc_capacity <<= 1;
+    header.toc_offset = align16(sizeof(PackHeader));
+
+    PackEntry* toc = (PackEntry*)calloc(header.toc_capacity, sizeof(PackEntry));
+    u8* slot_of = (u8*)calloc(count ? count : 1, sizeof(u8));
+    u4 mask = header.toc_capacity - 1;
+
+    u8 names_offset = header.toc_offset + sizeof(PackEntry) * (u8)header.toc_capacity;
+    u8 offset = names_offset;
+    for (u4 i = 0; i < count; i++) offset += strlen(names[i]) + 1;
+
+    b4 ok = true;
+    u8 name_offset = names_offset;
+    for (u4 i = 0; i < count && ok; i++)
+    {
+        u8 file_mtime, file_size;
+        ok = file_stat(paths[i], file_mtime, file_size);
+        if (!ok) break;
+
+        u8 hash = hash_string(names[i]);
+        u4 slot = (u4)hash & mask;
+        while (toc[slot].type != PACK_EMPTY) slot = (slot + 1) & mask;
+
+        offset = (offset + PACK_ALIGNMENT - 1) & ~(u8)(PACK_ALIGNMENT - 1);
+        toc[slot].name_hash = hash;
+        toc[slot].offset = offset;
+        toc[slot].size = file_size;
+        toc[slot].name_offset = name_offset;
+        toc[slot].name_size = (u4)strlen(names[i]);
+        toc[slot].type = types[i];
+        slot_of[i] = slot;
+        name_offset += toc[slot].name_size + 1;
+        offset += file_size;
+    }
+    header.file_size = offset;
+
+    char temp[512];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE* file = ok ? fopen(temp, "wb") : 0;
+    ok = file != 0;
+
+    static const u1 zeros[PACK_ALIGNMENT] = {};
+    u8 at = 0;
+    if (ok)
+    {
+        ok = fwrite(&header, 1, sizeof(header), file) == sizeof(header);
+        at = sizeof(header);
+        fwrite(zeros, 1, header.toc_offset - at, file);
+        ok = ok && fwrite(toc, sizeof(PackEntry), header.toc_capacity, file) == header.toc_capacity;
+        for (u4 i = 0; i < count && ok; i++)
+        {
+            ok = fwrite(names[i], 1, strlen(names[i]) + 1, file) == strlen(names[i]) + 1;
+        }
+        at = name_offset;
+    }
+    for (u4 i = 0; i < count && ok; i++)
+    {
+        PackEntry &entry = toc[slot_of[i]];
+        fwrite(zeros, 1, entry.offset - at, file);
+
+        MappedFile payload;
+        ok = map_file(payload, paths[i]) && payload.size == entry.size
+          && fwrite(payload.data, 1, payload.size, file) == payload.size;
+        unmap_file(payload);
+        at = entry.offset + entry.size;
+    }
+    if (file) ok = (fclose(file) == 0) && ok;
+
+    free(toc);
+    free(slot_of);
+
+    if (!ok || rename(temp, path) != 0)
+    {
+        remove(temp);
+        return false;
+    }
+    return true;
+}
@@ -2,6 +2,7 @@
 enum BODY_TYPES {
     TYPE_SPHERE = 0,
     TYPE_CUBOID,
+    TYPE_MESH,
 };
 
 struct Plane {
@@ -41,6 +42,7 @@ struct RigidBody
     vec3 angular_momentum;
     vec3 velocity;
     vec3 angular_velocity;
+    vec3 center_of_mass; // TYPE_MESH: from the mesh origin, scaled. pos is the center of mass
 
     vec3 force;
     vec3 torque;
@@ -54,16 +56,21 @@ struct RigidBody
 
     Plane* planes = 0;
     u4 num_plane = 0;
+
+    const MeshData* shape = 0; // TYPE_MESH
 };
 
 struct Entity 
 {
+    Handle id;
+
     /* Physics */
     RigidBody body;
+    Handle body_id;
 
     /* Rendering */
-    u4 mesh;
-    GLuint texture;
+    Handle mesh;
+    Handle texture;
 };
 
 struct BodyInfo {
@@ -77,6 +84,8 @@ struct BodyInfo {
     f4 width = 1.0f;
     f4 height = 1.0f;
     f4 depth = 1.0f;
+
+    const MeshData* shape = 0; // TYPE_MESH, scaled by width, height, depth
 };
 
 void step (RigidBody &body)
@@ -286,6 +295,8 @@ void init_body (RigidBody &body, BodyInfo info)
     body.height = info.height;
     body.depth = info.depth;
     body.type = info.type;
+    body.center_of_mass = setv();
+    body.shape = info.shape;
     
     switch (info.type)
     {
@@ -296,6 +307,28 @@ void init_body (RigidBody &body, BodyInfo info)
         case TYPE_CUBOID:
             body.volume = info.width * info.height * info.depth;
             break;
+
+        case TYPE_MESH:
+        {
+            const MeshData &shape = *info.shape;
+            body.volume = shape.volume * info.width * info.height * info.depth;
+            body.center_of_mass = setv(shape.center_of_mass.x * info.width,
+                                       shape.center_of_mass.y * info.height,
+                                       shape.center_of_mass.z * info.depth);
+
+            // collisions are still sphere tests, bound the hull around the center of mass
+            body.radius = 0.0f;
+            for (u4 i = 0; i < shape.hull_vertex_count; i++)
+            {
+                vec3 p = setv(shape.hull_vertices[i].x * info.width,
+                              shape.hull_vertices[i].y * info.height,
+                              shape.hull_vertices[i].z * info.depth);
+                f4 r = length(p - body.center_of_mass);
+                if (r > body.radius) body.radius = r;
+            }
+            if (body.radius == 0.0f) body.radius = info.radius;
+        }
+        break;
     }
 
     body.mass = body.density * body.volume;
@@ -334,6 +367,39 @@ void init_body (RigidBody &body, BodyInfo info)
             body.MoI_local[8] = Id;
         }
         break;
+
+        case TYPE_MESH:
+        {
+            /*
+                The mesh tensor is for unit density and unit scale. Scaling
+                is easy on the second moments C = integral of r r^T, which
+                are C = tr(I)/2 - I. Each entry picks up its two axis scales
+                and the volume scale, then I = tr(C) - C again.
+            */
+            const f4* I = info.shape->inertia; // xx yy zz xy yz xz
+            f4 half_trace = (I[0] + I[1] + I[2]) * 0.5f;
+            f4 s[3] = { info.width, info.height, info.depth };
+            f4 volume_scale = s[0] * s[1] * s[2];
+
+            mat3x3 C;
+            C[0] = half_trace - I[0]; C[1] = -I[3];             C[2] = -I[5];
+            C[3] = -I[3];             C[4] = half_trace - I[1]; C[5] = -I[4];
+            C[6] = -I[5];             C[7] = -I[4];             C[8] = half_trace - I[2];
+            for (u4 row = 0; row < 3; row++)
+            {
+                for (u4 col = 0; col < 3; col++)
+                {
+                    C[row * 3 + col] *= s[row] * s[col] * volume_scale * body.density;
+                }
+            }
+
+            f4 trace = C[0] + C[4] + C[8];
+            body.MoI_local = C * -1.0f;
+            body.MoI_local[0] += trace;
+            body.MoI_local[4] += trace;
+            body.MoI_local[8] += trace;
+        }
+        break;
     }
 
     body.inverse_MoI_local = inverse(body.MoI_local); // |I^-1 CM
@@ -348,12 +414,68 @@ void init_body (RigidBody &body, BodyInfo info)
     body.inverse_MoI_world = body.orientation * body.inverse_MoI_local * transpose(body.orientation); // I^-1 CM
 }
 
+/*
+    A mesh was reloaded, see process_uploads. Bodies shaped by it get
+    their mass properties from the new data, keep their motion, and keep
+    the mesh origin where it was, so pos follows the new center of mass.
+*/
+void refresh_mesh_bodies (const MeshData* shape)
+{
+    for (u4 i = 0; i < handles.used; i++)
+    {
+        HandleSlot &slot = handles.slots[i];
+        if (slot.type != HANDLE_BODY) continue;
+        RigidBody &body = *(RigidBody*)slot.data;
+        if (body.type != TYPE_MESH || body.shape != shape) continue;
+
+        RigidBody old = body;
+
+        BodyInfo info;
+        info.restitution = body.coefficient_restitution;
+        info.radius = body.radius;
+        info.density = body.density;
+        info.pos = body.pos;
+        info.type = body.type;
+        info.width = body.width;
+        info.height = body.height;
+        info.depth = body.depth;
+        info.shape = shape;
+        init_body(body, info);
+
+        body.pos = old.pos + (body.center_of_mass - old.center_of_mass) * old.orientation;
+        body.prev_pos = body.pos;
+        body.future_pos = body.pos;
+        body.velocity = old.velocity;
+        body.orientation = old.orientation;
+        body.angular_momentum = old.angular_momentum;
+        body.force = old.force;
+        body.torque = old.torque;
+        body.inverse_MoI_world = body.orientation * body.inverse_MoI_local * transpose(body.orientation);
+        body.angular_velocity = body.angular_momentum * body.inverse_MoI_world;
+    }
+}
+
 /*
 
     Utility functions
 
 */
 
+void register_entity (Entity &entity)
+{
+    // Entity must not move in memory while registered
+    entity.id = create_handle(handles, HANDLE_ENTITY, &entity);
+    entity.body_id = create_handle(handles, HANDLE_BODY, &entity.body);
+}
+
+void unregister_entity (Entity &entity)
+{
+    destroy_handle(handles, entity.body_id);
+    destroy_handle(handles, entity.id);
+    entity.id = 0;
+    entity.body_id = 0;
+}
+
 void add_planar_body (RigidBody &body, u4 total_plane)
 {
     body.planes = (Plane*)alloc(memory, sizeof(plane) * total_plane);
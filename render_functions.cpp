@@ -1,60 +1,561 @@
+#define LOD_MAX_PIXEL_ERROR 1.0f
+
+/*
+    Coarsest level whose error, projected at the mesh's distance, stays
+    under LOD_MAX_PIXEL_ERROR pixels
+*/
+u4 select_lod(RENDER_STATE &rs, Library::Mesh &mesh)
+{
+    if (mesh.data.lod_count < 2) return 0;
+
+    glm::vec4 eye = rs.view * glm::vec4(rs.world.x, rs.world.y, rs.world.z, 1.0f);
+    f4 distance = -eye.z;
+    if (distance <= 0.0f) return 0;
+
+    f4 scale = rs.scale.x > rs.scale.y ? rs.scale.x : rs.scale.y;
+    scale = rs.scale.z > scale ? rs.scale.z : scale;
+    f4 pixels_per_unit = rs.projection[1][1] * sgl.height * 0.5f / distance;
+
+    for (u4 lod = mesh.data.lod_count - 1; lod > 0; lod--)
+    {
+        if (mesh.data.lod_error[lod] * scale * pixels_per_unit <= LOD_MAX_PIXEL_ERROR) return lod;
+    }
+    return 0;
+}
+
+/*
+    Position dequantization and vertex setup for mesh, shared by the
+    single and the instanced path. With vertex arrays the setup is one
+    bind, otherwise it is specified again, see set_mesh_attributes.
+*/
+void bind_mesh(BASIC_TEXTURE_SHADER &shader, Library::Mesh &mesh, b4 instanced)
+{
+    if (mesh.vertex_format == VERTEX_PACKED)
+    {
+        /* Position dequantization, see vertexformat.cpp */
+        glm::vec3 extent = mesh.data.bounds_max - mesh.data.bounds_min;
+        glUniform3f(shader.uniform_position_offset, mesh.data.bounds_min.x, mesh.data.bounds_min.y, mesh.data.bounds_min.z);
+        glUniform3f(shader.uniform_position_scale, extent.x, extent.y, extent.z);
+    }
+    else
+    {
+        glUniform3f(shader.uniform_position_offset, 0.0f, 0.0f, 0.0f);
+        glUniform3f(shader.uniform_position_scale, 1.0f, 1.0f, 1.0f);
+    }
+
+    if (mesh.vertex_array)
+    {
+        bind_vertex_array(mesh.vertex_array);
+        return;
+    }
+
+    enable_vertex_attributes(set_mesh_attributes(mesh, instanced));
+    if (instancing) set_vertex_attribute_divisors(instanced ? INSTANCE_ATTRIBUTES : 0);
+    bind_buffer(GL_ELEMENT_ARRAY_BUFFER, mesh.index_buffer);
+}
+
+/*
+    translation * rotation * scale, put together column by column
+    instead of with two matrix products
+*/
+glm::mat4 model_matrix(RENDER_STATE &rs)
+{
+    glm::mat4 model = glm_matrix(rs.orient);
+    model[0] = model[0] * rs.scale.x;
+    model[1] = model[1] * rs.scale.y;
+    model[2] = model[2] * rs.scale.z;
+    model[3] = glm::vec4(rs.world.x, rs.world.y, rs.world.z, 1.0f);
+    return model;
+}
+
+/*
+    out[i] = a * b[i] for count matrices, out must not overlap b. Column
+    j of a product is a's columns weighted by the entries of b's column
+    j, with SSE a's columns stay in registers for the whole batch.
+*/
+void multiply_matrices(const glm::mat4 &a, const glm::mat4* b, glm::mat4* out, u4 count)
+{
+#ifdef __SSE__
+    const f4* pa = &a[0][0];
+    __m128 a0 = _mm_loadu_ps(pa);
+    __m128 a1 = _mm_loadu_ps(pa + 4);
+    __m128 a2 = _mm_loadu_ps(pa + 8);
+    __m128 a3 = _mm_loadu_ps(pa + 12);
+    for (u4 i = 0; i < count; i++)
+    {
+        const f4* m = &b[i][0][0];
+        f4* o = &out[i][0][0];
+        for (u4 j = 0; j < 4; j++)
+        {
+            __m128 column = _mm_mul_ps(a0, _mm_set1_ps(m[4 * j]));
+            column = _mm_add_ps(column, _mm_mul_ps(a1, _mm_set1_ps(m[4 * j + 1])));
+            column = _mm_add_ps(column, _mm_mul_ps(a2, _mm_set1_ps(m[4 * j + 2])));
+            column = _mm_add_ps(column, _mm_mul_ps(a3, _mm_set1_ps(m[4 * j + 3])));
+            _mm_storeu_ps(o + 4 * j, column);
+        }
+    }
+#else
+    for (u4 i = 0; i < count; i++)
+    {
+        out[i] = a * b[i];
+    }
+#endif
+}
+
+/*
+    Frustum culling
+
+    The six planes come out of proj * view (Gribb and Hartmann), as rows
+    combined, normalized so distances are in world units, pointing in.
+    cull_spheres tests bounding spheres stored as separate x, y, z and
+    radius arrays, four per SSE pass. Spheres that straddle a plane only
+    might be visible, box_in_frustum then checks the mesh AABB under the
+    model matrix, which is tighter for long or flat meshes.
+*/
+
+enum CULL_RESULTS {
+    CULL_OUTSIDE = 0,
+    CULL_INTERSECTS,
+    CULL_INSIDE,
+};
+
+struct Frustum
+{
+    f4 x[6];
+    f4 y[6];
+    f4 z[6];
+    f4 w[6];
+};
+
+Frustum frustum_planes(const glm::mat4 &view_projection)
+{
+    Frustum frustum;
+    const glm::mat4 &m = view_projection;
+    for (u4 p = 0; p < 6; p++)
+    {
+        // left, right, bottom, top, near, far: row 3 plus or minus row 0, 1, 2
+        u4 row = p / 2;
+        f4 sign = (p & 1) ? -1.0f : 1.0f;
+        f4 x = m[0][3] + sign * m[0][row];
+        f4 y = m[1][3] + sign * m[1][row];
+        f4 z = m[2][3] + sign * m[2][row];
+        f4 w = m[3][3] + sign * m[3][row];
+        f4 inverse_length = 1.0f / sqrtf(x * x + y * y + z * z);
+        frustum.x[p] = x * inverse_length;
+        frustum.y[p] = y * inverse_length;
+        frustum.z[p] = z * inverse_length;
+        frustum.w[p] = w * inverse_length;
+    }
+    return frustum;
+}
+
+void cull_spheres(Frustum &frustum, f4* x, f4* y, f4* z, f4* radius, u4 count, u1* result)
+{
+    u4 i = 0;
+#ifdef __SSE__
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 cx = _mm_loadu_ps(x + i);
+        __m128 cy = _mm_loadu_ps(y + i);
+        __m128 cz = _mm_loadu_ps(z + i);
+        __m128 r = _mm_loadu_ps(radius + i);
+        __m128 negative_r = _mm_sub_ps(_mm_setzero_ps(), r);
+        __m128 outside = _mm_setzero_ps();
+        __m128 crossing = _mm_setzero_ps();
+        for (u4 p = 0; p < 6; p++)
+        {
+            __m128 d = _mm_add_ps(
+                _mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(frustum.x[p])), _mm_mul_ps(cy, _mm_set1_ps(frustum.y[p]))),
+                _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(frustum.z[p])), _mm_set1_ps(frustum.w[p])));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(d, negative_r));
+            crossing = _mm_or_ps(crossing, _mm_cmplt_ps(d, r));
+        }
+        s4 outside_mask = _mm_movemask_ps(outside);
+        s4 crossing_mask = _mm_movemask_ps(crossing);
+        for (u4 lane = 0; lane < 4; lane++)
+        {
+            if (outside_mask & (1 << lane))       result[i + lane] = CULL_OUTSIDE;
+            else if (crossing_mask & (1 << lane)) result[i + lane] = CULL_INTERSECTS;
+            else                                  result[i + lane] = CULL_INSIDE;
+        }
+    }
+#endif
+    for (; i < count; i++)
+    {
+        result[i] = CULL_INSIDE;
+        for (u4 p = 0; p < 6; p++)
+        {
+            f4 d = x[i] * frustum.x[p] + y[i] * frustum.y[p] + z[i] * frustum.z[p] + frustum.w[p];
+            if (d < -radius[i])
+            {
+                result[i] = CULL_OUTSIDE;
+                break;
+            }
+            if (d < radius[i]) result[i] = CULL_INTERSECTS;
+        }
+    }
+}
+
+/*
+    The box's half extents projected on each plane normal give how far it
+    reaches towards the plane, the same test as for a sphere
+*/
+b4 box_in_frustum(Frustum &frustum, glm::vec3 bounds_min, glm::vec3 bounds_max, glm::mat4 &model)
+{
+    glm::vec3 center = (bounds_min + bounds_max) * 0.5f;
+    glm::vec3 half = (bounds_max - bounds_min) * 0.5f;
+    glm::vec4 world = model[3] + model[0] * center.x + model[1] * center.y + model[2] * center.z;
+    for (u4 p = 0; p < 6; p++)
+    {
+        f4 d = world.x * frustum.x[p] + world.y * frustum.y[p] + world.z * frustum.z[p] + frustum.w[p];
+        f4 reach = 0.0f;
+        for (u4 k = 0; k < 3; k++)
+        {
+            f4 along = model[k].x * frustum.x[p] + model[k].y * frustum.y[p] + model[k].z * frustum.z[p];
+            reach += fabsf(along) * half[k];
+        }
+        if (d < -reach) return false;
+    }
+    return true;
+}
+
 void render_mesh(RENDER_STATE &rs, Library::Mesh &mesh)
 {
     /* Bind texture */
-    glBindTexture(GL_TEXTURE_2D, rs.texture);
+    bind_texture(texture_target(), rs.texture);
 
     /* Select program */
-    glUseProgram(basic_texture.program);
-
-    /* View matrix */
-    glUniformMatrix4fv(basic_texture.uniform_view, 1, GL_FALSE, glm::value_ptr(rs.view));
-
-    /* Projection matrix */
-    glUniformMatrix4fv(basic_texture.uniform_proj, 1, GL_FALSE, glm::value_ptr(rs.projection));
-    
-    /* Translation matrix */
-    glm::vec3 translation;
-    translation.x = rs.world.x;
-    translation.y = rs.world.y;
-    translation.z = rs.world.z;
-    glm::mat4 model = glm::translate(glm::mat4(1.0f), translation);
-    glUniformMatrix4fv(basic_texture.uniform_model, 1, GL_FALSE, glm::value_ptr(model));
-
-    /* Rotation matrix */
-    glm::mat4 rotation = glm_matrix(rs.orient);
-    glUniformMatrix4fv(basic_texture.uniform_rotation, 1, GL_FALSE, glm::value_ptr(rotation));
-
-    /* Scale vector */
-    glUniform3f(basic_texture.uniform_scale,rs.scale.x,rs.scale.y,rs.scale.z);
-
-    /* Vertex buffer */
-    glEnableVertexAttribArray(basic_texture.attribute_coord3d);
-    glBindBuffer(GL_ARRAY_BUFFER, mesh.vertex_buffer);
-    glVertexAttribPointer(
-            basic_texture.attribute_coord3d, // attribute
-            3,                  // size
-            GL_FLOAT,           // type
-            GL_FALSE,           // normalized?
-            0,                  // stride
-            (void*)0            // array buffer offset
-        );
-
-    /* UV buffer */
-    glEnableVertexAttribArray(basic_texture.attribute_tex_coord2d);
-        glBindBuffer(GL_ARRAY_BUFFER, mesh.uv_buffer);
-        glVertexAttribPointer(
-            basic_texture.attribute_tex_coord2d, // attribute
-            2,                                // size
-            GL_FLOAT,                         // type
-            GL_FALSE,                         // normalized?
-            0,                                // stride
-            (void*)0                          // array buffer offset
-        );
+    use_program(basic_texture.program);
+
+    /* Array layer, see texturearray.cpp */
+    if (basic_texture.uniform_tex_layer >= 0)
+    {
+        glUniform1f(basic_texture.uniform_tex_layer, (f4)rs.layer);
+    }
+
+    /* Model and model view projection matrix */
+    glm::mat4 model = model_matrix(rs);
+    glm::mat4 mvp;
+    multiply_matrices(rs.projection * rs.view, &model, &mvp, 1);
+    glUniformMatrix4fv(basic_texture.uniform_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+    if (basic_texture.uniform_model >= 0)
+    {
+        glUniformMatrix4fv(basic_texture.uniform_model, 1, GL_FALSE, glm::value_ptr(model));
+    }
+
+    bind_mesh(basic_texture, mesh, false);
 
     /* Draw */
-    glDrawArrays(GL_TRIANGLES, 0, mesh.vertices.size() );
+    u4 lod = select_lod(rs, mesh);
+    glDrawElements(GL_TRIANGLES, mesh.data.lod_index_count[lod], GL_UNSIGNED_INT,
+        (void*)((u8)mesh.data.lod_offset[lod] * sizeof(u4)));
+    gl_state.draws++;
+}
+
+/*
+    Render queue
+
+    queue_draw collects draw packets (mesh, texture, program, transform)
+    instead of drawing. flush_draws first drops the ones outside the view
+    frustum, then gives each a 64 bit key
+        program 4 | texture 16 | mesh 16 | level of detail 4 | depth 24
+    radix sorts the keys in transient memory and draws in key order, so
+    state changes only happen between runs, and runs of the same mesh
+    and texture go out as one glDrawElementsInstanced. The model
+    matrices (translation * rotation * scale) sit next to the items, one
+    multiply_matrices call turns all of them into model view projection
+    matrices, and those, the model matrices and the array layers go into
+    the instance stream, see dynamicbuffer.cpp. With texture arrays, entities with different
+    textures of the same size share a run, the layer is per instance.
+
+    Without instancing the queue still sorts, then draws the packets one
+    by one with basic_texture, a matrix upload each.
+*/
+
+#define RENDER_QUEUE_MAX_DEPTH 1000.0f // view distance that maps to the largest depth key
+
+enum RENDER_PROGRAMS {
+    PROGRAM_BASIC_TEXTURE = 0,
+    PROGRAM_BASIC_TEXTURE_INSTANCED,
+};
+
+struct DrawItem
+{
+    u8 key;
+    u4 program;
+    Library::Mesh* mesh;
+    GLuint texture;
+    u4 layer;
+    u4 lod;
+    f4 depth;
+};
+
+struct DrawQueue
+{
+    DrawItem* items;
+    glm::mat4* models; // models[i] belongs to items[i]
+    f4* sphere_x;      // world space bounding spheres, same
+    f4* sphere_y;
+    f4* sphere_z;
+    f4* sphere_radius;
+    u4 count;
+    u4 capacity;
+    u4 culled;         // this frame so far
+    glm::mat4 view_projection;
+} draw_queue;
+
+// items come from transient memory, so this is per frame
+void begin_draws(glm::mat4 view, glm::mat4 projection, u4 capacity)
+{
+    draw_queue.items = (DrawItem*)alloc_transient(memory, sizeof(DrawItem) * (u8)capacity);
+    draw_queue.models = (glm::mat4*)alloc_transient(memory, sizeof(glm::mat4) * (u8)capacity);
+    draw_queue.sphere_x = (f4*)alloc_transient(memory, sizeof(f4) * (u8)capacity);
+    draw_queue.sphere_y = (f4*)alloc_transient(memory, sizeof(f4) * (u8)capacity);
+    draw_queue.sphere_z = (f4*)alloc_transient(memory, sizeof(f4) * (u8)capacity);
+    draw_queue.sphere_radius = (f4*)alloc_transient(memory, sizeof(f4) * (u8)capacity);
+    draw_queue.count = 0;
+    draw_queue.culled = 0;
+    draw_queue.capacity = capacity;
+    if (!draw_queue.items || !draw_queue.models || !draw_queue.sphere_x || !draw_queue.sphere_y
+        || !draw_queue.sphere_z || !draw_queue.sphere_radius)
+    {
+        cout << "ERROR: Out of transient memory, nothing drawn this frame" << endl;
+        draw_queue.capacity = 0;
+    }
+    draw_queue.view_projection = projection * view;
+}
+
+void flush_draws();
+
+void queue_draw(RENDER_STATE &rs, Library::Mesh &mesh)
+{
+    if (draw_queue.count == draw_queue.capacity) flush_draws();
+    if (draw_queue.count == draw_queue.capacity) return; // no queue this frame
+
+    u4 index = draw_queue.count++;
+    glm::mat4 &model = draw_queue.models[index];
+    DrawItem &item = draw_queue.items[index];
+    item.program = instancing ? PROGRAM_BASIC_TEXTURE_INSTANCED : PROGRAM_BASIC_TEXTURE;
+    item.mesh = &mesh;
+    item.texture = rs.texture;
+    item.layer = rs.layer;
+    item.lod = select_lod(rs, mesh);
+    item.depth = -(rs.view * glm::vec4(rs.world.x, rs.world.y, rs.world.z, 1.0f)).z;
+    model = model_matrix(rs);
+
+    glm::vec3 c = mesh.sphere_center;
+    glm::vec4 center = model[3] + model[0] * c.x + model[1] * c.y + model[2] * c.z;
+    f4 scale = fabsf(rs.scale.x) > fabsf(rs.scale.y) ? fabsf(rs.scale.x) : fabsf(rs.scale.y);
+    scale = fabsf(rs.scale.z) > scale ? fabsf(rs.scale.z) : scale;
+    draw_queue.sphere_x[index] = center.x;
+    draw_queue.sphere_y[index] = center.y;
+    draw_queue.sphere_z[index] = center.z;
+    draw_queue.sphere_radius[index] = mesh.sphere_radius * scale;
+}
+
+/*
+    Keeps the queued draws that may be visible, in order
+*/
+void cull_draws()
+{
+    Frustum frustum = frustum_planes(draw_queue.view_projection);
+    u1* result = (u1*)alloc_transient(memory, sizeof(u1) * (u8)draw_queue.count);
+    if (!result) return; // everything is drawn
+    cull_spheres(frustum, draw_queue.sphere_x, draw_queue.sphere_y, draw_queue.sphere_z,
+        draw_queue.sphere_radius, draw_queue.count, result);
+
+    u4 kept = 0;
+    for (u4 i = 0; i < draw_queue.count; i++)
+    {
+        if (result[i] == CULL_OUTSIDE) continue;
+        if (result[i] == CULL_INTERSECTS)
+        {
+            MeshData &data = draw_queue.items[i].mesh->data;
+            if (!box_in_frustum(frustum, data.bounds_min, data.bounds_max, draw_queue.models[i])) continue;
+        }
+        draw_queue.items[kept] = draw_queue.items[i];
+        draw_queue.models[kept] = draw_queue.models[i];
+        kept++;
+    }
+    draw_queue.culled += draw_queue.count - kept;
+    draw_queue.count = kept;
+}
+
+/*
+    Texture names and mesh slots are truncated to their field. Two that
+    collide only sort together, runs are split on the real values.
+*/
+inline u8 draw_key(DrawItem &item)
+{
+    f4 depth = item.depth < 0.0f ? 0.0f : (item.depth > RENDER_QUEUE_MAX_DEPTH ? RENDER_QUEUE_MAX_DEPTH : item.depth);
+    u8 depth_bits = (u8)(depth / RENDER_QUEUE_MAX_DEPTH * (f4)0xFFFFFF); // front to back
+    u8 mesh_index = (u8)(item.mesh - library.meshes);
+
+    return ((u8)(item.program & 0xF) << 60)
+         | ((u8)(item.texture & 0xFFFF) << 44)
+         | ((mesh_index & 0xFFFF) << 28)
+         | ((u8)(item.lod & 0xF) << 24)
+         | depth_bits;
+}
+
+inline b4 same_run(DrawItem &a, DrawItem &b)
+{
+    return a.program == b.program && a.mesh == b.mesh && a.texture == b.texture && a.lod == b.lod;
+}
+
+/*
+    Least significant digit first radix sort of count keys, a byte per
+    pass. Passes where every key has the same byte are skipped, with few
+    programs and textures most of the high bytes are. Returns the sorted
+    item indices, in transient memory, 0 if they don't fit.
+*/
+u4* radix_sort_draws(DrawItem* items, u4 count)
+{
+    u8* keys        = (u8*)alloc_transient(memory, sizeof(u8) * (u8)count);
+    u8* keys_swap   = (u8*)alloc_transient(memory, sizeof(u8) * (u8)count);
+    u4* order       = (u4*)alloc_transient(memory, sizeof(u4) * (u8)count);
+    u4* order_swap  = (u4*)alloc_transient(memory, sizeof(u4) * (u8)count);
+    if (!keys || !keys_swap || !order || !order_swap) return 0;
+    for (u4 i = 0; i < count; i++)
+    {
+        keys[i] = items[i].key;
+        order[i] = i;
+    }
+
+    for (u4 shift = 0; shift < 64; shift += 8)
+    {
+        u4 histogram[256] = {};
+        for (u4 i = 0; i < count; i++) histogram[(keys[i] >> shift) & 0xFF]++;
+        if (histogram[(keys[0] >> shift) & 0xFF] == count) continue;
+
+        u4 sum = 0;
+        for (u4 digit = 0; digit < 256; digit++)
+        {
+            u4 n = histogram[digit];
+            histogram[digit] = sum;
+            sum += n;
+        }
+        for (u4 i = 0; i < count; i++)
+        {
+            u4 slot = histogram[(keys[i] >> shift) & 0xFF]++;
+            keys_swap[slot] = keys[i];
+            order_swap[slot] = order[i];
+        }
+
+        u8* k = keys; keys = keys_swap; keys_swap = k;
+        u4* o = order; order = order_swap; order_swap = o;
+    }
+    return order;
+}
+
+/*
+    One packet with basic_texture
+*/
+void draw_single(DrawItem &item, glm::mat4 &mvp, glm::mat4 &model)
+{
+    BASIC_TEXTURE_SHADER &shader = basic_texture;
+
+    bind_texture(texture_target(), item.texture);
+    if (shader.uniform_tex_layer >= 0)
+    {
+        glUniform1f(shader.uniform_tex_layer, (f4)item.layer);
+    }
+    glUniformMatrix4fv(shader.uniform_mvp, 1, GL_FALSE, glm::value_ptr(mvp));
+    if (shader.uniform_model >= 0)
+    {
+        glUniformMatrix4fv(shader.uniform_model, 1, GL_FALSE, glm::value_ptr(model));
+    }
+
+    bind_mesh(shader, *item.mesh, false);
+    glDrawElements(GL_TRIANGLES, item.mesh->data.lod_index_count[item.lod], GL_UNSIGNED_INT,
+        (void*)((u8)item.mesh->data.lod_offset[item.lod] * sizeof(u4)));
+    gl_state.draws++;
+}
+
+/*
+    A run of packets sharing program, mesh, texture and level of detail
+*/
+void draw_instanced(DrawItem* items, u4* order, u4 count, glm::mat4* mvps, InstanceData* instances)
+{
+    BASIC_TEXTURE_SHADER &shader = basic_texture_instanced;
+    DrawItem &run = items[order[0]];
+
+    bind_texture(texture_target(), run.texture);
+    bind_mesh(shader, *run.mesh, true);
+
+    // a run longer than a frame of the stream goes out in pieces
+    for (u4 first = 0; first < count; first += INSTANCE_STREAM_INSTANCES)
+    {
+        u4 chunk = count - first < INSTANCE_STREAM_INSTANCES ? count - first : INSTANCE_STREAM_INSTANCES;
+        for (u4 i = 0; i < chunk; i++)
+        {
+            u4 index = order[first + i];
+            instances[i].mvp = mvps[index];
+            instances[i].model = draw_queue.models[index];
+            instances[i].layer = (f4)items[index].layer;
+        }
+
+        u4 offset = push_dynamic(instance_stream, instances, sizeof(InstanceData) * chunk);
+        if (offset == DYNAMIC_BUFFER_FULL) return;
+        set_instance_attributes(offset);
+
+        glDrawElementsInstancedARB(GL_TRIANGLES, run.mesh->data.lod_index_count[run.lod], GL_UNSIGNED_INT,
+            (void*)((u8)run.mesh->data.lod_offset[run.lod] * sizeof(u4)), chunk);
+        gl_state.draws++;
+    }
+}
+
+void flush_draws()
+{
+    if (!draw_queue.count) return;
+
+    uint64_t start = transient_mark(memory);
+
+    cull_draws();
+    if (!draw_queue.count)
+    {
+        release_transient(memory, start);
+        return;
+    }
+
+    DrawItem* items = draw_queue.items;
+    for (u4 i = 0; i < draw_queue.count; i++) items[i].key = draw_key(items[i]);
+    u4* order = radix_sort_draws(items, draw_queue.count);
+
+    glm::mat4* mvps = (glm::mat4*)alloc_transient(memory, sizeof(glm::mat4) * (u8)draw_queue.count);
+
+    InstanceData* instances = 0;
+    if (instancing)
+    {
+        instances = (InstanceData*)alloc_transient(memory, sizeof(InstanceData) * (u8)draw_queue.count);
+    }
+    if (!order || !mvps || (instancing && !instances))
+    {
+        cout << "ERROR: Out of transient memory, " << draw_queue.count << " draws dropped" << endl;
+        release_transient(memory, start);
+        draw_queue.count = 0;
+        return;
+    }
+    multiply_matrices(draw_queue.view_projection, draw_queue.models, mvps, draw_queue.count);
+
+    for (u4 first = 0; first < draw_queue.count;)
+    {
+        DrawItem &item = items[order[first]];
+        if (item.program != PROGRAM_BASIC_TEXTURE_INSTANCED)
+        {
+            use_program(basic_texture.program);
+            draw_single(item, mvps[order[first]], draw_queue.models[order[first]]);
+            first++;
+            continue;
+        }
+
+        u4 end = first + 1;
+        while (end < draw_queue.count && same_run(item, items[order[end]])) end++;
+        use_program(basic_texture_instanced.program);
+        draw_instanced(items, order + first, end - first, mvps, instances);
+        first = end;
+    }
 
-    /* Disable buffers */
-    glDisableVertexAttribArray(basic_texture.attribute_coord3d);
-    glDisableVertexAttribArray(basic_texture.attribute_tex_coord2d);
-}
\ No newline at end of file
+    release_transient(memory, start);
+    draw_queue.count = 0;
+}
@@ -1,3 +1,5 @@
+b4 init_opengl ();
+
 b4 create_sdl_opengl_window ()
 {
     sgl.width = 800;
@@ -23,9 +25,22 @@ b4 create_sdl_opengl_window ()
         return false;
     }
 
+    return init_opengl();
+}
+
+/*
+    Everything after context creation, for the window and the headless
+    context alike
+*/
+b4 init_opengl ()
+{
     //Initialize GLEW
     glewExperimental = GL_TRUE;
     GLenum glew_status = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+    // a GLX build of GLEW still loads the functions under EGL, it only misses the GLX ones
+    if (sgl.headless && glew_status == GLEW_ERROR_NO_GLX_DISPLAY) glew_status = GLEW_OK;
+#endif
     if (glew_status != GLEW_OK)
     {
         cerr << "Error: glewInit: " << glewGetErrorString(glew_status) << endl;
@@ -37,6 +52,49 @@ b4 create_sdl_opengl_window ()
         return false;
     }
 
+    // packed vertices have half float UVs
+    if (GLEW_VERSION_3_0 || GLEW_ARB_half_float_vertex)
+    {
+        vertex_format = VERTEX_PACKED;
+    }
+
+    // baked textures are BC1/BC3, see texturecompress.cpp
+    if (GLEW_EXT_texture_compression_s3tc)
+    {
+        texture_compression = true;
+    }
+
+    // entities sharing a mesh draw in one call, see render_functions.cpp
+    if (GLEW_ARB_instanced_arrays && GLEW_ARB_draw_instanced)
+    {
+        instancing = true;
+    }
+
+    // all textures become layers of arrays, see texturearray.cpp
+    if (GLEW_VERSION_3_0 || GLEW_EXT_texture_array)
+    {
+        texture_arrays = true;
+    }
+
+    // meshes keep their attribute setup in a vertex array object
+    if (GLEW_VERSION_3_0 || GLEW_ARB_vertex_array_object)
+    {
+        vertex_arrays = true;
+    }
+
+    // nothing is bound yet, see glstate.cpp
+    reset_gl_state();
+
+    /*
+        The vertex arrays point at the instance stream, so it exists from
+        the start. Its storage also keeps the per instance arrays valid
+        for the draws that don't use them.
+    */
+    if (instancing)
+    {
+        create_dynamic_buffer(instance_stream, sizeof(InstanceData) * INSTANCE_STREAM_INSTANCES);
+    }
+
     glEnable(GL_BLEND);
     glBlendFunc(GL_SRC_ALPHA,GL_ONE_MINUS_SRC_ALPHA);
 
@@ -58,6 +116,112 @@ b4 create_sdl_opengl_window ()
     return true;
 }
 
+/*
+    Headless rendering, for benchmarks on machines without a display
+
+    An EGL context without any surface (EGL_MESA_platform_surfaceless,
+    or the default display with EGL_KHR_surfaceless_context) renders
+    into sgl.framebuffer, color and depth renderbuffers of the given
+    size. Mesa's software rasterizer is enough. Needs SGL_HEADLESS
+    defined and -lEGL, see HOW_TO_BUILD.txt.
+*/
+b4 create_headless_context (s4 width, s4 height)
+{
+#ifdef SGL_HEADLESS
+    sgl.width = width;
+    sgl.height = height;
+    sgl.headless = true;
+
+    PFNEGLGETPLATFORMDISPLAYEXTPROC get_platform_display =
+        (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+    sgl.display = EGL_NO_DISPLAY;
+    if (get_platform_display)
+    {
+        sgl.display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, 0);
+    }
+    if (sgl.display == EGL_NO_DISPLAY) sgl.display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+    EGLint major, minor;
+    if (sgl.display == EGL_NO_DISPLAY || !eglInitialize(sgl.display, &major, &minor))
+    {
+        cerr << "Error: no EGL display" << endl;
+        return false;
+    }
+    const char* extensions = eglQueryString(sgl.display, EGL_EXTENSIONS);
+    if (!extensions || !strstr(extensions, "EGL_KHR_surfaceless_context"))
+    {
+        cerr << "Error: EGL_KHR_surfaceless_context unsupported" << endl;
+        return false;
+    }
+
+    // no surface is ever made, any surface type will do
+    EGLint config_attributes[] = {
+        EGL_SURFACE_TYPE, 0,
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_NONE
+    };
+    EGLConfig config;
+    EGLint config_count = 0;
+    if (!eglBindAPI(EGL_OPENGL_API)
+        || !eglChooseConfig(sgl.display, config_attributes, &config, 1, &config_count) || !config_count)
+    {
+        cerr << "Error: no EGL config for desktop OpenGL" << endl;
+        return false;
+    }
+
+    sgl.context = eglCreateContext(sgl.display, config, EGL_NO_CONTEXT, 0);
+    if (sgl.context == EGL_NO_CONTEXT || !eglMakeCurrent(sgl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, sgl.context))
+    {
+        cerr << "Error: can't create a surfaceless EGL context: 0x" << hex << eglGetError() << dec << endl;
+        return false;
+    }
+
+    if (!init_opengl()) return false;
+
+    if (!GLEW_VERSION_3_0 && !GLEW_ARB_framebuffer_object)
+    {
+        cerr << "Error: headless rendering needs framebuffer objects" << endl;
+        return false;
+    }
+    glGenRenderbuffers(2, sgl.renderbuffers);
+    glBindRenderbuffer(GL_RENDERBUFFER, sgl.renderbuffers[0]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, sgl.renderbuffers[1]);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+
+    glGenFramebuffers(1, &sgl.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, sgl.framebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, sgl.renderbuffers[0]);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, sgl.renderbuffers[1]);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        cerr << "Error: headless framebuffer incomplete" << endl;
+        return false;
+    }
+
+    // without a surface nothing sets the viewport
+    glViewport(0, 0, width, height);
+
+    printf("Headless: %s, %s\n", glGetString(GL_RENDERER), glGetString(GL_VERSION));
+    return true;
+#else
+    cerr << "Error: built without SGL_HEADLESS, no headless rendering" << endl;
+    return false;
+#endif
+}
+
+void destroy_headless_context ()
+{
+#ifdef SGL_HEADLESS
+    if (!sgl.headless) return;
+    glDeleteFramebuffers(1, &sgl.framebuffer);
+    glDeleteRenderbuffers(2, sgl.renderbuffers);
+    eglMakeCurrent(sgl.display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglDestroyContext(sgl.display, sgl.context);
+    eglTerminate(sgl.display);
+#endif
+}
+
 void create_plane () {
     GLfloat plane_vertices[] = {
         -1.0f, -1.0f, 0.0f, //VO - 0
@@ -66,7 +230,7 @@ void create_plane () {
          1.0f,  1.0f, 0.0f, //V3 - 3
     };
     glGenBuffers(1, &plane.verts);
-    glBindBuffer(GL_ARRAY_BUFFER, plane.verts);
+    bind_buffer(GL_ARRAY_BUFFER, plane.verts);
     glBufferData(GL_ARRAY_BUFFER, sizeof(plane_vertices), plane_vertices, GL_STATIC_DRAW);
     
     GLfloat plane_colors_black[] = {
@@ -77,14 +241,14 @@ void create_plane () {
         0.06, 0.52, 0.15,
     };
     glGenBuffers(1, &plane.colors);
-    glBindBuffer(GL_ARRAY_BUFFER, plane.colors);
+    bind_buffer(GL_ARRAY_BUFFER, plane.colors);
     glBufferData(GL_ARRAY_BUFFER, sizeof(plane_colors_black), plane_colors_black, GL_STATIC_DRAW);
     
     GLushort plane_elements[] = {
         0,1,2, 1,3,2,
     };
     glGenBuffers(1, &plane.indices);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, plane.indices);
+    bind_buffer(GL_ELEMENT_ARRAY_BUFFER, plane.indices);
     glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(plane_elements), plane_elements, GL_STATIC_DRAW);
 
     GLfloat plane_uv[] = {
@@ -94,7 +258,7 @@ void create_plane () {
         1.0f, 0.0f, //3
     };
     glGenBuffers(1, &plane.uv_coords);
-    glBindBuffer(GL_ARRAY_BUFFER, plane.uv_coords);
+    bind_buffer(GL_ARRAY_BUFFER, plane.uv_coords);
     glBufferData(GL_ARRAY_BUFFER, sizeof(plane_uv), plane_uv, GL_STATIC_DRAW);
 }
 
@@ -111,7 +275,7 @@ GLuint my_create_texture (s4 sw, s4 sh, b4 alpha, unsigned char* image_data = 0,
     glGenTextures(1, &textureID);
     
     // "Bind" the newly created texture : all future texture functions will modify this texture
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    bind_texture(GL_TEXTURE_2D, textureID);
 
     if (is_render_target)
     {
@@ -150,131 +314,425 @@ GLuint my_create_texture (s4 sw, s4 sh, b4 alpha, unsigned char* image_data = 0,
     return textureID;
 }
 
-void load_texture (const char *filename, u4 w, u4 h, u4 components)
+/*
+    Uploads every level of a texture. A single level texture (freshly
+    decoded) gets its mip chain generated by the driver instead.
+    Block compressed levels go up as they are, see texturecompress.cpp.
+*/
+GLuint upload_texture_levels (TextureData &texture)
 {
-    IMAGE image;
-    image.data = stbi_load(filename, &image.x, &image.y, &image.n, components);
-    if (image.data == NULL)
+    GLenum format = texture_gl_format(texture.format);
+    GLenum target = texture_target();
+
+    GLuint textureID;
+    glGenTextures(1, &textureID);
+    bind_texture(target, textureID);
+
+    // levels are tightly packed, rows of odd sized levels aren't 4 byte aligned
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (u4 level = 0; level < texture.level_count; level++)
     {
-        cout << "Failed to load texture: " << filename << endl;
-        return;
+        if (compressed_format(texture.format) && texture_arrays)
+        {
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, format,
+                level_dimension(texture.width, level), level_dimension(texture.height, level), 1,
+                0, (GLsizei)texture.level_size[level], texture.levels[level]);
+        }
+        else if (compressed_format(texture.format))
+        {
+            glCompressedTexImage2D(GL_TEXTURE_2D, level, format,
+                level_dimension(texture.width, level), level_dimension(texture.height, level),
+                0, (GLsizei)texture.level_size[level], texture.levels[level]);
+        }
+        else if (texture_arrays)
+        {
+            // a one layer array, pack_textures merges it with others later
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format,
+                level_dimension(texture.width, level), level_dimension(texture.height, level), 1,
+                0, format, GL_UNSIGNED_BYTE, texture.levels[level]);
+        }
+        else
+        {
+            glTexImage2D(GL_TEXTURE_2D, level, format,
+                level_dimension(texture.width, level), level_dimension(texture.height, level),
+                0, format, GL_UNSIGNED_BYTE, texture.levels[level]);
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+
+    if (texture.level_count == 1)
+    {
+        glGenerateMipmap(target);
+    }
+    else
+    {
+        glTexParameteri(target, GL_TEXTURE_MAX_LEVEL, texture.level_count - 1);
+    }
+    glTexParameteri(target, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(target, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(target, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(target, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+    return textureID;
+}
+
+/*
+    Takes a library slot and a handle for an asset. The handle resolves to
+    nothing until the asset has been uploaded, see finish_texture/finish_mesh.
+    Slots emptied by unloading or a failed load are used again, and keep
+    their name if it is the same file. 0 when the library is full.
+*/
+Library::Texture* reserve_texture (const char* filename)
+{
+    u4 slot = 0;
+    while (slot < library.texture_count && library.textures[slot].handle) slot++;
+    if (slot == library.texture_capacity)
+    {
+        cout << "Texture library full, failed to add: " << filename << endl;
+        return 0;
+    }
+
+    Library::Texture &texture = library.textures[slot];
+    char* name = slot < library.texture_count && strcmp(texture.name, filename) == 0
+               ? texture.name : alloc_string(memory, filename);
+    if (!name) return 0;
+    if (slot == library.texture_count) library.texture_count++;
+
+    texture = {};
+    texture.name = name;
+    texture.handle = create_handle(handles, HANDLE_TEXTURE, 0);
+    bind_name(handles, texture.name, texture.handle);
+    return &texture;
+}
+
+Library::Mesh* reserve_mesh (const char* filename)
+{
+    u4 slot = 0;
+    while (slot < library.mesh_count && library.meshes[slot].handle) slot++;
+    if (slot == library.mesh_capacity)
+    {
+        cout << "Mesh library full, failed to add: " << filename << endl;
+        return 0;
+    }
+
+    Library::Mesh &mesh = library.meshes[slot];
+    char* name = slot < library.mesh_count && strcmp(mesh.name, filename) == 0
+               ? mesh.name : alloc_string(memory, filename);
+    if (!name) return 0;
+    if (slot == library.mesh_count) library.mesh_count++;
+
+    mesh = {};
+    mesh.name = name;
+    mesh.handle = create_handle(handles, HANDLE_MESH, 0);
+    bind_name(handles, mesh.name, mesh.handle);
+    return &mesh;
+}
+
+// Loading failed, nothing should resolve to the slot. The name may point at a newer handle by now.
+void abandon_asset (const char* name, Handle &h, u4 type)
+{
+    if (find_handle(handles, name, type) == h) unbind_name(handles, name);
+    destroy_handle(handles, h);
+    h = 0;
+}
+
+void finish_texture (Library::Texture &texture, TextureData &data)
+{
+    texture.id = upload_texture_levels(data);
+    texture_uploads++;
+    texture.layer = 0;
+    texture.format = data.format;
+    texture.width = data.width;
+    texture.height = data.height;
+    // a single decoded level got the whole chain from glGenerateMipmap
+    texture.level_count = data.level_count == 1 ? mip_level_count(data.width, data.height) : data.level_count;
+    set_handle_data(handles, texture.handle, &texture);
+}
+
+/*
+    Points the per instance locations at the instance entries from offset
+    on in the instance stream. The offset moves every run, without base
+    instance support this is how a draw starts at its own entries.
+*/
+void set_instance_attributes(u4 offset)
+{
+    // a mat4 attribute is four vec4 columns at consecutive locations
+    bind_buffer(GL_ARRAY_BUFFER, instance_stream.buffer);
+    for (u4 column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(ATTRIBUTE_INSTANCE_MVP + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+            (void*)(offset + offsetof(InstanceData, mvp) + sizeof(f4) * 4 * column));
+        glVertexAttribPointer(ATTRIBUTE_INSTANCE_MODEL + column, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+            (void*)(offset + offsetof(InstanceData, model) + sizeof(f4) * 4 * column));
+    }
+    glVertexAttribPointer(ATTRIBUTE_INSTANCE_LAYER, 1, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+        (void*)(offset + offsetof(InstanceData, layer)));
+}
+
+/*
+    Points the attribute locations (see VERTEX_ATTRIBUTES) at the mesh's
+    vertex buffer, and at the instance stream for instanced draws.
+    Returns the arrays to enable. With vertex arrays this runs once per
+    mesh, otherwise before every draw.
+*/
+u4 set_mesh_attributes(Library::Mesh &mesh, b4 instanced)
+{
+    bind_buffer(GL_ARRAY_BUFFER, mesh.vertex_buffer);
+    if (mesh.vertex_format == VERTEX_PACKED)
+    {
+        glVertexAttribPointer(ATTRIBUTE_COORD3D, 3, GL_UNSIGNED_SHORT, GL_TRUE,
+            sizeof(PackedVertex), (void*)offsetof(PackedVertex, position));
+        glVertexAttribPointer(ATTRIBUTE_NORMAL_OCT, 2, GL_SHORT, GL_TRUE,
+            sizeof(PackedVertex), (void*)offsetof(PackedVertex, normal));
+        glVertexAttribPointer(ATTRIBUTE_TEX_COORD2D, 2, GL_HALF_FLOAT, GL_FALSE,
+            sizeof(PackedVertex), (void*)offsetof(PackedVertex, uv));
     }
-    GLuint texture_id = my_create_texture(w, h, true, image.data, false, image.n);
+    else
+    {
+        glVertexAttribPointer(ATTRIBUTE_COORD3D, 3, GL_FLOAT, GL_FALSE,
+            sizeof(FloatVertex), (void*)offsetof(FloatVertex, position));
+        glVertexAttribPointer(ATTRIBUTE_NORMAL_OCT, 2, GL_SHORT, GL_TRUE,
+            sizeof(FloatVertex), (void*)offsetof(FloatVertex, normal));
+        glVertexAttribPointer(ATTRIBUTE_TEX_COORD2D, 2, GL_FLOAT, GL_FALSE,
+            sizeof(FloatVertex), (void*)offsetof(FloatVertex, uv));
+    }
+    if (!instanced) return MESH_ATTRIBUTES;
+
+    set_instance_attributes(0);
+    return MESH_ATTRIBUTES | INSTANCE_ATTRIBUTES;
+}
+
+/*
+    Uploads mesh.data and makes the handle resolve to the slot. False if
+    the vertices can't be staged, then nothing is created and the slot's
+    GL objects are left as they were.
+*/
+b4 finish_mesh (Library::Mesh &mesh)
+{
+    // staged in its own malloc'd buffer, a big mesh doesn't fit in the frame's transient arena
+    u8 vertex_size = vertex_format == VERTEX_PACKED ? sizeof(PackedVertex) : sizeof(FloatVertex);
+    void* staging = malloc(vertex_size * (u8)mesh.data.vertex_count);
+    if (!staging)
+    {
+        cout << "Out of memory staging vertices: " << mesh.name << endl;
+        return false;
+    }
+    mesh.vertex_format = vertex_format;
+    if (mesh.vertex_format == VERTEX_PACKED) pack_vertices(mesh.data, (PackedVertex*)staging);
+    else                                     interleave_vertices(mesh.data, (FloatVertex*)staging);
 
-    stbi_image_free(image.data);
+    // the vertex array goes first, the element buffer binding is part of it
+    if (vertex_arrays)
+    {
+        glGenVertexArrays(1, &mesh.vertex_array);
+        bind_vertex_array(mesh.vertex_array);
+    }
+
+    compute_bounding_sphere(mesh.data, mesh.sphere_center, mesh.sphere_radius);
+
+    glGenBuffers(1, &mesh.vertex_buffer);
+    bind_buffer(GL_ARRAY_BUFFER, mesh.vertex_buffer);
+    glBufferData(GL_ARRAY_BUFFER, vertex_size * mesh.data.vertex_count, staging, GL_STATIC_DRAW);
+    free(staging);
+
+    glGenBuffers(1, &mesh.index_buffer);
+    bind_buffer(GL_ELEMENT_ARRAY_BUFFER, mesh.index_buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
+        mesh.data.index_count * sizeof(u4), 
+        mesh.data.indices, GL_STATIC_DRAW);
 
     /*
-        add to texture list
+        Instance arrays go in too, basic_texture doesn't read their
+        locations, so the one vertex array serves both variants
     */
-    library.textures[library.texture_count].name = filename;
-    library.textures[library.texture_count].id = texture_id;
-    library.texture_count++;
+    if (vertex_arrays)
+    {
+        enable_vertex_attributes(set_mesh_attributes(mesh, instancing));
+        if (instancing) set_vertex_attribute_divisors(INSTANCE_ATTRIBUTES);
+        bind_vertex_array(0);
+    }
+
+    set_handle_data(handles, mesh.handle, &mesh);
+    return true;
 }
 
-// void assign_texture (Entity &entity, const char* filename)
-// {
-//     b4 found = false;
-//     for (u4 i = 0; i < library.texture_count; i++)
-//     {
-//         if (library.textures[i].name == filename)
-//         {
-//             entity.texture = library.textures[i].id;
-//             found = true;
-//             break;
-//         }
-//     }
-//     if (!found)
-//     {
-//         cout << "Failed to assign texture: " << filename << endl;
-//     }
-// }
-
-GLuint get_texture (const char* filename)
+/*
+    Physics holds on to the hull after the rest of the CPU copy is gone.
+    Each slot keeps it in its own malloc'd block, replaced on reload, so
+    old copies don't pile up. Out of memory drops the hull.
+*/
+void keep_hull (Library::Mesh &mesh)
 {
-    GLuint texture_id = 0;
-    b4 found = false;
-    for (u4 i = 0; i < library.texture_count; i++)
+    u8 vertices_size = sizeof(glm::vec3) * (u8)mesh.data.hull_vertex_count;
+    u8 indices_size = sizeof(u4) * (u8)mesh.data.hull_index_count;
+    u1* block = vertices_size ? (u1*)malloc(vertices_size + indices_size) : 0;
+    if (block)
     {
-        if (library.textures[i].name == filename)
-        {
-            texture_id = library.textures[i].id;
-            found = true;
-            break;
-        }
+        memcpy(block, mesh.data.hull_vertices, vertices_size);
+        memcpy(block + vertices_size, mesh.data.hull_indices, indices_size);
     }
-    if (!found)
+    free(mesh.hull_block);
+    mesh.hull_block = block;
+
+    if (!block)
     {
-        cout << "Failed to get texture: " << filename << endl;
+        drop_hull(mesh.data);
+        return;
     }
-    return texture_id;
+    mesh.data.hull_vertices = (glm::vec3*)block;
+    mesh.data.hull_indices = (u4*)(block + vertices_size);
 }
 
-// void assign_mesh (Entity &entity, const char* filename)
-// {
-//     b4 found = false;
-//     for (u4 i = 0; i < library.mesh_count; i++)
-//     {
-//         if (library.meshes[i].name == filename)
-//         {
-//             entity.mesh = i;
-//             found = true;
-//             break;
-//         }
-//     }
-//     if (!found)
-//     {
-//         cout << "Failed to assign mesh: " << filename << endl;
-//     }
-// }
-
-u4 get_mesh (const char* filename)
+/*
+    Synchronous loads, done before returning. See streaming.cpp for
+    loading in the background.
+*/
+Handle load_texture (const char *filename, u4 components = 3)
 {
-    b4 found = false;
-    u4 mesh_index = 0;
-    for (u4 i = 0; i < library.mesh_count; i++)
+    Handle existing = find_handle(handles, filename, HANDLE_TEXTURE);
+    if (existing) return existing;
+
+    Library::Texture* texture = reserve_texture(filename);
+    if (!texture) return 0;
+
+    TextureData data;
+    MappedFile mapping;
+    b4 decoded;
+    if (!load_texture_data(filename, components, data, mapping, decoded))
     {
-        if (library.meshes[i].name == filename)
-        {
-            mesh_index = i;
-            found = true;
-            break;
-        }
+        cout << "Failed to load texture: " << filename << endl;
+        abandon_asset(texture->name, texture->handle, HANDLE_TEXTURE);
+        return 0;
     }
-    if (!found)
+
+    finish_texture(*texture, data);
+
+    if (decoded) stbi_image_free(data.levels[0]);
+    unmap_file(mapping);
+
+    return texture->handle;
+}
+
+inline Library::Texture* lookup_texture (Handle h)
+{
+    return (Library::Texture*)get_handle_data(handles, h, HANDLE_TEXTURE);
+}
+
+inline Library::Mesh* lookup_mesh (Handle h)
+{
+    return (Library::Mesh*)get_handle_data(handles, h, HANDLE_MESH);
+}
+
+/*
+    Name lookups are for load time. Returns 0 (never a valid handle) on failure.
+*/
+Handle get_texture (const char* filename)
+{
+    Handle h = find_handle(handles, filename, HANDLE_TEXTURE);
+    if (!h)
+    {
+        cout << "Failed to get texture: " << filename << endl;
+    }
+    return h;
+}
+
+Handle get_mesh (const char* filename)
+{
+    Handle h = find_handle(handles, filename, HANDLE_MESH);
+    if (!h)
     {
         cout << "Failed to assign mesh: " << filename << endl;
     }
-    return mesh_index;
+    return h;
 }
 
-void load_mesh (const char * filename)
+Handle load_mesh (const char * filename, b4 keep_cpu_copy = false)
 {
-    /*
-        add to mesh list
-    */
-    u4 c = library.mesh_count;
-    library.meshes[c].name = filename;
+    Handle existing = find_handle(handles, filename, HANDLE_MESH);
+    if (existing) return existing;
 
-    if (!loadOBJ(filename, library.meshes[c].vertices, library.meshes[c].uvs, library.meshes[c].normals))
+    Library::Mesh* slot = reserve_mesh(filename);
+    if (!slot) return 0;
+    Library::Mesh &mesh = *slot;
+
+    uint64_t vertex_data = permanent_mark(memory);
+
+    MappedFile mapping;
+    if (!load_mesh_data(filename, memory, mesh.data, mapping))
     {
         cout << "Failed  to load mesh: " << filename << endl;
-        return;
+        release_permanent(memory, vertex_data);
+        abandon_asset(mesh.name, mesh.handle, HANDLE_MESH);
+        return 0;
+    }
+    if (!finish_mesh(mesh))
+    {
+        cout << "Failed  to load mesh: " << filename << endl;
+        mesh.data = {};
+        release_permanent(memory, vertex_data);
+        unmap_file(mapping);
+        abandon_asset(mesh.name, mesh.handle, HANDLE_MESH);
+        return 0;
     }
-    glGenBuffers(1, &library.meshes[c].vertex_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, library.meshes[c].vertex_buffer);
-    glBufferData(GL_ARRAY_BUFFER, 
-        library.meshes[c].vertices.size() * sizeof(glm::vec3), 
-        &library.meshes[c].vertices[0], GL_STATIC_DRAW);
 
-    glGenBuffers(1, &library.meshes[c].uv_buffer);
-    glBindBuffer(GL_ARRAY_BUFFER, library.meshes[c].uv_buffer);
-    glBufferData(GL_ARRAY_BUFFER, 
-        library.meshes[c].uvs.size() * sizeof(glm::vec2), 
-        &library.meshes[c].uvs[0], GL_STATIC_DRAW);
+    /*
+        The GPU has its own copy now. Hand the CPU copy back to the arena
+        (or close the cache mapping) unless the caller wants to keep it.
+        Nothing allocated means the data lives in a mapping or the pack.
+        The hull always stays, physics uses it.
+    */
+    keep_hull(mesh);
+    if (keep_cpu_copy && permanent_mark(memory) == vertex_data && !copy_mesh_data(memory, mesh.data))
+    {
+        cout << "Out of memory, mesh data only on the GPU: " << filename << endl;
+        keep_cpu_copy = false;
+    }
+    if (!keep_cpu_copy)
+    {
+        mesh.data.vertices = 0;
+        mesh.data.uvs = 0;
+        mesh.data.normals = 0;
+        mesh.data.indices = 0;
+        release_permanent(memory, vertex_data);
+    }
+    unmap_file(mapping);
 
-    library.mesh_count++;
+    return mesh.handle;
 };
 
+/*
+    Unloading invalidates every copy of the handle. The library slot is
+    left empty for the next reserve, its name stays in permanent memory.
+*/
+void unload_texture (Handle h)
+{
+    Library::Texture* texture = lookup_texture(h);
+    if (!texture) return;
+
+    // a packed array stays while other textures use it, the layer is wasted until then
+    if (!texture_id_shared(texture->id, texture)) delete_texture(texture->id);
+    unbind_name(handles, texture->name);
+    destroy_handle(handles, h);
+    texture->id = 0;
+    texture->handle = 0;
+}
+
+void unload_mesh (Handle h)
+{
+    Library::Mesh* mesh = lookup_mesh(h);
+    if (!mesh) return;
+
+    delete_vertex_array(mesh->vertex_array);
+    delete_buffer(mesh->vertex_buffer);
+    delete_buffer(mesh->index_buffer);
+    free(mesh->hull_block);
+    unbind_name(handles, mesh->name);
+    destroy_handle(handles, h);
+    char* name = mesh->name;
+    *mesh = {};
+    mesh->name = name;
+}
+
 glm::vec3 glmv(vec3 v) {
     return glm::vec3(v.x,v.y,v.z);
 }
\ No newline at end of file
@@ -6,7 +6,7 @@
 
 char* file_read(const char* filename, int* size);
 void print_log(GLuint object);
-GLuint create_shader(const char* filename, GLenum type);
+GLuint create_shader(const char* filename, GLenum type, const char* defines = "");
 GLuint create_program(const char* vertexfile, const char *fragmentfile);
 GLint get_attrib(GLuint program, const char *name);
 GLint get_uniform(GLuint program, const char *name);
@@ -68,9 +68,10 @@ void print_log(GLuint object) {
 }
 
 /**
- * Compile the shader from file 'filename', with error handling
+ * Compile the shader from file 'filename', with error handling.
+ * 'defines' goes in right after the version line.
  */
-GLuint create_shader(const char* filename, GLenum type) {
+GLuint create_shader(const char* filename, GLenum type, const char* defines) {
     const GLchar* source = file_read(filename, NULL);
     if (source == NULL) {
         SDL_LogMessage(SDL_LOG_CATEGORY_APPLICATION, SDL_LOG_PRIORITY_ERROR,
@@ -81,7 +82,7 @@ GLuint create_shader(const char* filename, GLenum type) {
 
     // GLSL version
     const char* version;
-    int profile;
+    int profile = 0; // stays 0 without SDL video, headless
     SDL_GL_GetAttribute(SDL_GL_CONTEXT_PROFILE_MASK, &profile);
     if (profile == SDL_GL_CONTEXT_PROFILE_ES)
         version = "#version 100\n";  // OpenGL ES 2.0
@@ -106,10 +107,11 @@ GLuint create_shader(const char* filename, GLenum type) {
 
     const GLchar* sources[] = {
         version,
+        defines,
         precision,
         source
     };
-    glShaderSource(res, 3, sources, NULL);
+    glShaderSource(res, 4, sources, NULL);
     free((void*)source);
     
     glCompileShader(res);
@@ -176,45 +178,105 @@ GLint get_uniform(GLuint program, const char *name) {
     Begin custom code.
 */
 
-b4 create_basic_texture_shader()
+/*
+    Builds one variant of basic_texture. The instanced one takes its
+    matrices and array layer per instance, see render_functions.cpp.
+*/
+b4 build_basic_texture_shader(BASIC_TEXTURE_SHADER &shader, b4 instanced)
 {
     GLint link_ok = GL_FALSE;
     
     GLuint vs, fs;
-    if ((vs = create_shader("basic_texture.v.glsl", GL_VERTEX_SHADER))   == 0) return false;
-    if ((fs = create_shader("basic_texture.f.glsl", GL_FRAGMENT_SHADER)) == 0) return false;
+    const char* vertex_defines = instanced ? "#define INSTANCED\n" : "";
+    if ((vs = create_shader("basic_texture.v.glsl", GL_VERTEX_SHADER, vertex_defines)) == 0) return false;
+    // the #extension has to come before any declarations, so it goes in with the define
+    const char* fragment_defines;
+    if (texture_arrays) fragment_defines = instanced
+        ? "#define TEXTURE_ARRAY\n#extension GL_EXT_texture_array : enable\n#define INSTANCED\n"
+        : "#define TEXTURE_ARRAY\n#extension GL_EXT_texture_array : enable\n";
+    else fragment_defines = instanced ? "#define INSTANCED\n" : "";
+    if ((fs = create_shader("basic_texture.f.glsl", GL_FRAGMENT_SHADER, fragment_defines)) == 0)
+    {
+        glDeleteShader(vs);
+        return false;
+    }
     
     /*
-        Create and link program.
+        Create and link program. shader is only touched once it linked,
+        a failed hot reload leaves it and the GL objects as they were.
     */
-    basic_texture.program = glCreateProgram();
-    glAttachShader(basic_texture.program, vs);
-    glAttachShader(basic_texture.program, fs);
-    glLinkProgram(basic_texture.program);
-    glGetProgramiv(basic_texture.program, GL_LINK_STATUS, &link_ok);
+    GLuint program = glCreateProgram();
+    glAttachShader(program, vs);
+    glAttachShader(program, fs);
+    // fixed locations, the meshes' vertex arrays rely on them
+    glBindAttribLocation(program, ATTRIBUTE_COORD3D, "coord3d");
+    glBindAttribLocation(program, ATTRIBUTE_NORMAL_OCT, "normal_oct");
+    glBindAttribLocation(program, ATTRIBUTE_TEX_COORD2D, "tex_coord2d");
+    if (instanced)
+    {
+        glBindAttribLocation(program, ATTRIBUTE_INSTANCE_MVP, "instance_mvp");
+        glBindAttribLocation(program, ATTRIBUTE_INSTANCE_MODEL, "instance_model");
+        glBindAttribLocation(program, ATTRIBUTE_INSTANCE_LAYER, "instance_layer");
+    }
+    glLinkProgram(program);
+    glGetProgramiv(program, GL_LINK_STATUS, &link_ok);
+
+    // the program keeps what it needs, the shader objects can go either way
+    glDetachShader(program, vs);
+    glDetachShader(program, fs);
+    glDeleteShader(vs);
+    glDeleteShader(fs);
     if (!link_ok)
     {
         cerr << "glLinkProgram:";
-        print_log(basic_texture.program);
+        print_log(program);
+        glDeleteProgram(program);
         return false;
     }
+    shader.program = program;
 
     /*
         Link vars
     */
     // attributes
-    basic_texture.attribute_coord3d = get_attrib(basic_texture.program, "coord3d"); 
-    basic_texture.attribute_tex_coord2d = get_attrib(basic_texture.program, "tex_coord2d"); 
+    shader.attribute_coord3d = get_attrib(shader.program, "coord3d"); 
+    shader.attribute_tex_coord2d = get_attrib(shader.program, "tex_coord2d"); 
+    // compiled out until the fragment shader uses the normal, so don't complain
+    shader.attribute_normal_oct = glGetAttribLocation(shader.program, "normal_oct");
 
     // vertex uniforms
-    basic_texture.uniform_scale = get_uniform(basic_texture.program, "scale");
-    basic_texture.uniform_model = get_uniform(basic_texture.program, "model");
-    basic_texture.uniform_view = get_uniform(basic_texture.program, "view");
-    basic_texture.uniform_proj = get_uniform(basic_texture.program, "proj");
-    basic_texture.uniform_rotation = get_uniform(basic_texture.program, "rotation");
+    shader.uniform_position_offset = get_uniform(shader.program, "position_offset");
+    shader.uniform_position_scale = get_uniform(shader.program, "position_scale");
+    if (instanced)
+    {
+        shader.uniform_mvp = -1;
+        shader.uniform_model = -1;
+        shader.attribute_instance_mvp = get_attrib(shader.program, "instance_mvp");
+        // compiled out until the fragment shader uses the normal
+        shader.attribute_instance_model = glGetAttribLocation(shader.program, "instance_model");
+        // compiled out without texture arrays
+        shader.attribute_instance_layer = glGetAttribLocation(shader.program, "instance_layer");
+    }
+    else
+    {
+        shader.uniform_mvp = get_uniform(shader.program, "mvp");
+        // compiled out until the fragment shader uses the normal
+        shader.uniform_model = glGetUniformLocation(shader.program, "model");
+        shader.attribute_instance_mvp = -1;
+        shader.attribute_instance_model = -1;
+        shader.attribute_instance_layer = -1;
+    }
 
     // fragment uniforms
-    basic_texture.uniform_tex_source = get_uniform(basic_texture.program, "tex_source");
+    shader.uniform_tex_source = get_uniform(shader.program, "tex_source");
+    shader.uniform_tex_layer = texture_arrays && !instanced ? get_uniform(shader.program, "tex_layer") : -1;
         
     return true;
-}
\ No newline at end of file
+}
+
+b4 create_basic_texture_shader()
+{
+    if (!build_basic_texture_shader(basic_texture, false)) return false;
+    if (instancing && !build_basic_texture_shader(basic_texture_instanced, true)) return false;
+    return true;
+}
@@ -0,0 +1,425 @@
+/*
+    Levels of detail
+
+    Each level halves the triangle count of the one before by quadric
+    error metric edge collapse (Garland & Heckbert, "Surface
+    Simplification Using Quadric Error Metrics"). Every vertex position
+    carries the sum of the planes of the triangles around it; collapsing
+    an edge moves one end onto the other and costs the squared distance
+    of the target to all planes gathered so far.
+
+    Collapses only move a vertex onto an existing one, so the levels reuse
+    the full mesh's vertex buffer and only add indices. Work is done on
+    positions: vertices split by a UV or normal seam are welded for
+    topology, and each split copy follows into the matching copy at the
+    other end of the edge.
+
+    Positions on an open border never move, so holes don't grow. A
+    collapse that would flip a triangle is skipped.
+
+    Every pass sorts candidate edges by cost and takes the cheapest ones,
+    at most one collapse per neighbourhood, until the level's triangle
+    target is reached or nothing can collapse.
+*/
+
+#define LOD_MIN_TRIANGLES 64
+
+struct Quadric
+{
+    f8 a00, a01, a02, a11, a12, a22;
+    f8 b0, b1, b2;
+    f8 c;
+};
+
+inline void add_quadric(Quadric &q, const Quadric &r)
+{
+    q.a00 += r.a00; q.a01 += r.a01; q.a02 += r.a02;
+    q.a11 += r.a11; q.a12 += r.a12; q.a22 += r.a22;
+    q.b0 += r.b0; q.b1 += r.b1; q.b2 += r.b2;
+    q.c += r.c;
+}
+
+// squared distance of p to every plane summed into q
+inline f8 quadric_error(const Quadric &q, glm::vec3 p)
+{
+    f8 x = p.x, y = p.y, z = p.z;
+    f8 error = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z
+             + 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z)
+             + 2.0 * (q.b0 * x + q.b1 * y + q.b2 * z)
+             + q.c;
+    return error > 0.0 ? error : 0.0;
+}
+
+inline glm::vec3 triangle_normal(glm::vec3 p0, glm::vec3 p1, glm::vec3 p2)
+{
+    glm::vec3 e1 = p1 - p0;
+    glm::vec3 e2 = p2 - p0;
+    return glm::vec3(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z, e1.x * e2.y - e1.y * e2.x);
+}
+
+inline f4 dot3(glm::vec3 a, glm::vec3 b) { return a.x * b.x + a.y * b.y + a.z * b.z; }
+
+struct Collapse
+{
+    f4 cost;
+    u4 from;
+    u4 to;
+};
+
+struct Simplifier
+{
+    MeshData* mesh;
+    u4* position_of; // vertex -> first vertex with the same position
+    u4* next_wedge;  // ring of the vertices that share a position
+    Quadric* quadrics; // by position
+    u1* locked;        // by position
+    u1* touched;       // by position, this pass
+    u4* remap;         // vertex -> vertex, this pass
+
+    // position -> triangles, rebuilt every pass
+    u4* triangle_offset;
+    u4* triangle_count;
+    u4* triangles;
+
+    Collapse* collapses;
+};
+
+void build_position_adjacency(Simplifier &s, const u4* indices, u4 index_count)
+{
+    u4 vertex_count = s.mesh->vertex_count;
+    memset(s.triangle_count, 0, sizeof(u4) * (u8)vertex_count);
+    for (u4 i = 0; i < index_count; i++) s.triangle_count[s.position_of[indices[i]]]++;
+
+    u4 sum = 0;
+    for (u4 v = 0; v < vertex_count; v++)
+    {
+        s.triangle_offset[v] = sum;
+        sum += s.triangle_count[v];
+        s.triangle_count[v] = 0;
+    }
+    for (u4 i = 0; i < index_count; i++)
+    {
+        u4 p = s.position_of[indices[i]];
+        s.triangles[s.triangle_offset[p] + s.triangle_count[p]++] = i / 3;
+    }
+}
+
+// False if the temporaries don't fit in transient memory
+b4 init_simplifier(Simplifier &s, MeshData &mesh, const u4* indices, u4 index_count, GameMemory &memory)
+{
+    u4 n = mesh.vertex_count;
+    s.mesh = &mesh;
+    s.position_of = (u4*)alloc_transient(memory, sizeof(u4) * (u8)n);
+    s.next_wedge  = (u4*)alloc_transient(memory, sizeof(u4) * (u8)n);
+    s.quadrics    = (Quadric*)alloc_transient(memory, sizeof(Quadric) * (u8)n);
+    s.locked      = (u1*)alloc_transient(memory, (u8)n);
+    s.touched     = (u1*)alloc_transient(memory, (u8)n);
+    s.remap       = (u4*)alloc_transient(memory, sizeof(u4) * (u8)n);
+    s.triangle_offset = (u4*)alloc_transient(memory, sizeof(u4) * (u8)n);
+    s.triangle_count  = (u4*)alloc_transient(memory, sizeof(u4) * (u8)n);
+    s.triangles       = (u4*)alloc_transient(memory, sizeof(u4) * (u8)index_count);
+    s.collapses       = (Collapse*)alloc_transient(memory, sizeof(Collapse) * (u8)index_count);
+
+    /*
+        Weld by exact position
+    */
+    u4 table_size = 16;
+    while (table_size < n * 2) table_size <<= 1;
+    u4 mask = table_size - 1;
+    u4* table = (u4*)alloc_transient(memory, sizeof(u4) * table_size);
+    if (!s.position_of || !s.next_wedge || !s.quadrics || !s.locked || !s.touched || !s.remap
+        || !s.triangle_offset || !s.triangle_count || !s.triangles || !s.collapses || !table)
+    {
+        return false;
+    }
+    memset(table, 0xFF, sizeof(u4) * table_size);
+
+    for (u4 v = 0; v < n; v++)
+    {
+        u4 key[3];
+        memcpy(key, &mesh.vertices[v], sizeof(key));
+        u4 slot = hash_corner(key) & mask;
+        while (table[slot] != OBJ_NONE && memcmp(&mesh.vertices[table[slot]], key, sizeof(key)) != 0)
+        {
+            slot = (slot + 1) & mask;
+        }
+        if (table[slot] == OBJ_NONE)
+        {
+            table[slot] = v;
+            s.position_of[v] = v;
+            s.next_wedge[v] = v;
+        }
+        else
+        {
+            u4 first = table[slot];
+            s.position_of[v] = first;
+            s.next_wedge[v] = s.next_wedge[first];
+            s.next_wedge[first] = v;
+        }
+        s.remap[v] = v;
+    }
+
+    /*
+        Plane of every triangle into its corners
+    */
+    memset(s.quadrics, 0, sizeof(Quadric) * (u8)n);
+    for (u4 i = 0; i < index_count; i += 3)
+    {
+        glm::vec3 p0 = mesh.vertices[indices[i + 0]];
+        glm::vec3 normal = triangle_normal(p0, mesh.vertices[indices[i + 1]], mesh.vertices[indices[i + 2]]);
+        f8 length = sqrt((f8)dot3(normal, normal));
+        if (length == 0.0) continue;
+
+        f8 a = normal.x / length, b = normal.y / length, c = normal.z / length;
+        f8 d = -(a * p0.x + b * p0.y + c * p0.z);
+        Quadric q = { a * a, a * b, a * c, b * b, b * c, c * c, a * d, b * d, c * d, d * d };
+        for (u4 k = 0; k < 3; k++) add_quadric(s.quadrics[s.position_of[indices[i + k]]], q);
+    }
+
+    /*
+        Lock positions on open edges: edge a->b with no triangle going b->a
+    */
+    memset(s.locked, 0, (u8)n);
+    build_position_adjacency(s, indices, index_count);
+    for (u4 a = 0; a < n; a++)
+    {
+        if (s.position_of[a] != a) continue;
+        for (u4 i = 0; i < s.triangle_count[a]; i++)
+        {
+            const u4* tri = indices + (u8)s.triangles[s.triangle_offset[a] + i] * 3;
+            u4 k = s.position_of[tri[0]] == a ? 0 : (s.position_of[tri[1]] == a ? 1 : 2);
+            u4 b = s.position_of[tri[(k + 1) % 3]];
+
+            b4 twin = false;
+            for (u4 j = 0; j < s.triangle_count[b] && !twin; j++)
+            {
+                const u4* other = indices + (u8)s.triangles[s.triangle_offset[b] + j] * 3;
+                for (u4 m = 0; m < 3; m++)
+                {
+                    if (s.position_of[other[m]] == b && s.position_of[other[(m + 1) % 3]] == a) twin = true;
+                }
+            }
+            if (!twin) s.locked[a] = s.locked[b] = 1;
+        }
+    }
+    return true;
+}
+
+// Would moving position from onto to turn any remaining triangle around from over?
+b4 collapse_flips(Simplifier &s, const u4* indices, u4 from, u4 to)
+{
+    glm::vec3* vertices = s.mesh->vertices;
+    for (u4 i = 0; i < s.triangle_count[from]; i++)
+    {
+        const u4* tri = indices + (u8)s.triangles[s.triangle_offset[from] + i] * 3;
+        u4 p[3] = { s.position_of[tri[0]], s.position_of[tri[1]], s.position_of[tri[2]] };
+        if (p[0] == to || p[1] == to || p[2] == to) continue; // collapses away
+
+        glm::vec3 before = triangle_normal(vertices[p[0]], vertices[p[1]], vertices[p[2]]);
+        glm::vec3 moved[3];
+        for (u4 k = 0; k < 3; k++) moved[k] = vertices[p[k] == from ? to : p[k]];
+        glm::vec3 after = triangle_normal(moved[0], moved[1], moved[2]);
+
+        f4 d = dot3(before, after);
+        if (d <= 0.0f || d * d < 0.04f * dot3(before, before) * dot3(after, after)) return true;
+    }
+    return false;
+}
+
+/*
+    Points every split copy of position from at the copy of position to
+    that shares a triangle with it, or failing that the closest in UV
+*/
+void remap_wedges(Simplifier &s, const u4* indices, u4 from, u4 to)
+{
+    u4 w = from;
+    do
+    {
+        u4 target = OBJ_NONE;
+        for (u4 i = 0; i < s.triangle_count[from] && target == OBJ_NONE; i++)
+        {
+            const u4* tri = indices + (u8)s.triangles[s.triangle_offset[from] + i] * 3;
+            if (tri[0] != w && tri[1] != w && tri[2] != w) continue;
+            for (u4 k = 0; k < 3; k++)
+            {
+                if (s.position_of[tri[k]] == to) target = tri[k];
+            }
+        }
+        if (target == OBJ_NONE)
+        {
+            f4 best = 0.0f;
+            u4 t = to;
+            do
+            {
+                f4 du = s.mesh->uvs[t].x - s.mesh->uvs[w].x;
+                f4 dv = s.mesh->uvs[t].y - s.mesh->uvs[w].y;
+                f4 distance = du * du + dv * dv;
+                if (target == OBJ_NONE || distance < best)
+                {
+                    best = distance;
+                    target = t;
+                }
+                t = s.next_wedge[t];
+            } while (t != to);
+        }
+        s.remap[w] = target;
+        w = s.next_wedge[w];
+    } while (w != from);
+}
+
+u4 simplify_pass(Simplifier &s, u4* indices, u4 index_count, u4 target_count, f4 &max_error)
+{
+    build_position_adjacency(s, indices, index_count);
+
+    /*
+        Cheapest direction of every edge, each edge once (a < b)
+    */
+    u4 candidates = 0;
+    for (u4 i = 0; i < index_count; i += 3)
+    {
+        for (u4 k = 0; k < 3; k++)
+        {
+            u4 a = s.position_of[indices[i + k]];
+            u4 b = s.position_of[indices[i + (k + 1) % 3]];
+            if (a >= b || (s.locked[a] && s.locked[b])) continue;
+
+            Quadric q = s.quadrics[a];
+            add_quadric(q, s.quadrics[b]);
+            f8 a_to_b = s.locked[a] ? -1.0 : quadric_error(q, s.mesh->vertices[b]);
+            f8 b_to_a = s.locked[b] ? -1.0 : quadric_error(q, s.mesh->vertices[a]);
+
+            Collapse &c = s.collapses[candidates++];
+            if (b_to_a < 0.0 || (a_to_b >= 0.0 && a_to_b <= b_to_a))
+            {
+                c.cost = (f4)a_to_b; c.from = a; c.to = b;
+            }
+            else
+            {
+                c.cost = (f4)b_to_a; c.from = b; c.to = a;
+            }
+        }
+    }
+    qsort(s.collapses, candidates, sizeof(Collapse), [] (const void* a, const void* b) {
+        f4 x = ((const Collapse*)a)->cost, y = ((const Collapse*)b)->cost;
+        return x < y ? -1 : (x > y ? 1 : 0);
+    });
+
+    // a collapse removes about two triangles
+    u4 needed = (index_count - target_count) / 6 + 1;
+    u4 done = 0;
+    memset(s.touched, 0, (u8)s.mesh->vertex_count);
+
+    for (u4 i = 0; i < candidates && done < needed; i++)
+    {
+        Collapse c = s.collapses[i];
+        if (s.touched[c.from] || s.touched[c.to]) continue;
+        if (collapse_flips(s, indices, c.from, c.to)) continue;
+
+        remap_wedges(s, indices, c.from, c.to);
+        add_quadric(s.quadrics[c.to], s.quadrics[c.from]);
+        if (c.cost > max_error) max_error = c.cost;
+        done++;
+
+        // the flip test above assumed the neighbourhood stays put this pass
+        for (u4 j = 0; j < s.triangle_count[c.from]; j++)
+        {
+            const u4* tri = indices + (u8)s.triangles[s.triangle_offset[c.from] + j] * 3;
+            for (u4 k = 0; k < 3; k++) s.touched[s.position_of[tri[k]]] = 1;
+        }
+    }
+    if (done == 0) return index_count;
+
+    /*
+        Rewrite, dropping triangles that lost an edge
+    */
+    u4 out = 0;
+    for (u4 i = 0; i < index_count; i += 3)
+    {
+        u4 v0 = s.remap[indices[i + 0]];
+        u4 v1 = s.remap[indices[i + 1]];
+        u4 v2 = s.remap[indices[i + 2]];
+        u4 p0 = s.position_of[v0], p1 = s.position_of[v1], p2 = s.position_of[v2];
+        if (p0 == p1 || p1 == p2 || p0 == p2) continue;
+        indices[out++] = v0;
+        indices[out++] = v1;
+        indices[out++] = v2;
+    }
+    for (u4 v = 0; v < s.mesh->vertex_count; v++) s.remap[v] = v;
+
+    return out;
+}
+
+/*
+    Adds up to MESH_MAX_LODS - 1 levels after level 0. Each level starts
+    from the previous one, keeping the quadrics gathered so far. Meshes
+    below 2 * LOD_MIN_TRIANGLES stay single level. The new index array is
+    permanent, temporaries are transient. Out of memory the mesh keeps
+    the levels that fit, at least level 0.
+*/
+void build_lods(MeshData &mesh, GameMemory &memory)
+{
+    u4 base = mesh.lod_index_count[0];
+    if (base / 3 < LOD_MIN_TRIANGLES * 2) return;
+
+    uint64_t start = transient_mark(memory);
+
+    Simplifier s;
+    u4* work = 0;
+    if (init_simplifier(s, mesh, mesh.indices, base, memory))
+    {
+        work = (u4*)alloc_transient(memory, sizeof(u4) * (u8)base);
+    }
+    if (!work)
+    {
+        printf("Out of memory, no levels of detail\n");
+        release_transient(memory, start);
+        return;
+    }
+    memcpy(work, mesh.indices, sizeof(u4) * (u8)base);
+
+    u4* levels[MESH_MAX_LODS] = { mesh.indices };
+    u4 count = base;
+    f4 error = 0.0f;
+    u4 total = base;
+    u4 lod_count = 1;
+
+    for (u4 lod = 1; lod < MESH_MAX_LODS; lod++)
+    {
+        u4 target = ((base / 3) >> lod) * 3;
+        if (target / 3 < LOD_MIN_TRIANGLES) break;
+
+        u4 previous = count;
+        while (count > target)
+        {
+            u4 next = simplify_pass(s, work, count, target, error);
+            if (next == count) break;
+            count = next;
+        }
+        if ((u8)count * 10 > (u8)previous * 9) break; // stuck, the next level would look the same
+
+        levels[lod] = (u4*)alloc_transient(memory, sizeof(u4) * (u8)count);
+        if (!levels[lod]) break;
+        memcpy(levels[lod], work, sizeof(u4) * (u8)count);
+        mesh.lod_index_count[lod] = count;
+        mesh.lod_error[lod] = sqrtf(error);
+        total += count;
+        lod_count++;
+    }
+
+    u4* indices = lod_count > 1 ? (u4*)alloc(memory, sizeof(u4) * (u8)total) : 0;
+    if (indices)
+    {
+        u4 offset = 0;
+        for (u4 lod = 0; lod < lod_count; lod++)
+        {
+            memcpy(indices + offset, levels[lod], sizeof(u4) * (u8)mesh.lod_index_count[lod]);
+            mesh.lod_offset[lod] = offset;
+            offset += mesh.lod_index_count[lod];
+        }
+        mesh.indices = indices;
+        mesh.index_count = total;
+        mesh.lod_count = lod_count;
+    }
+
+    release_transient(memory, start);
+}
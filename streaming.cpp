@@ -0,0 +1,484 @@
+/*
+    Background asset loading
+
+    request_mesh/request_texture hand out a handle right away and queue
+    the load. Worker threads do the file I/O, OBJ parsing and PNG decoding
+    and push the result onto a lock free queue. The GL thread drains that
+    queue once per frame in process_uploads, up to a byte budget, so a big
+    batch of requests never stalls a frame. Until its upload is done a
+    handle resolves to nothing, and render code already skips those.
+
+    Textures queued together decode at the same time, one per worker,
+    and only the glTexImage2D calls are serialized on the GL thread.
+
+    Each worker has its own GameMemory arena, since the global one isn't
+    thread safe. Parsed meshes are copied out of it into one malloc'd
+    block that the GL thread frees after upload. Anything found in the
+    asset pack or a baked file is uploaded straight from the mapping.
+    A mesh too big for a worker's arena is retried on the GL thread.
+*/
+
+void refresh_mesh_bodies (const MeshData* shape); // physics.cpp
+
+#define STREAM_QUEUE_SIZE 256 // power of two
+#define STREAM_MAX_WORKERS 8
+#define UPLOAD_BUDGET Megabytes(8)
+
+/*
+    Room to parse, simplify and optimize an OBJ of a couple hundred
+    thousand triangles. Bigger ones fail on the worker and are loaded
+    again on the GL thread in the main arena, see retry_mesh_load.
+*/
+#define STREAM_ARENA_MEGABYTES 32
+#define STREAM_ARENA_TRANSIENT_MEGABYTES 128
+
+enum STREAM_TYPES {
+    STREAM_MESH = 1,
+    STREAM_TEXTURE,
+};
+
+struct StreamJob
+{
+    u4 type;
+    Handle handle;
+    void* slot;       // Library::Mesh* or Library::Texture*
+    const char* name; // permanent memory
+    u4 components;
+    b4 reload;        // slot already has GL objects, replace them after upload
+
+    // filled in by the worker
+    b4 ok;
+    u8 bytes;
+    MappedFile mapping;
+    MeshData mesh;
+    void* mesh_block;
+    TextureData texture;
+    b4 decoded;
+};
+
+/*
+    Bounded multi producer, multi consumer queue (Dmitry Vyukov's). Every
+    cell carries a sequence number that says whether it is ready to be
+    written or read for the current lap around the ring.
+*/
+struct JobQueue
+{
+    struct Cell
+    {
+        std::atomic<u4> sequence;
+        StreamJob job;
+    };
+    Cell cells[STREAM_QUEUE_SIZE];
+    std::atomic<u4> head; // next push
+    std::atomic<u4> tail; // next pop
+};
+
+void init_queue(JobQueue &queue)
+{
+    for (u4 i = 0; i < STREAM_QUEUE_SIZE; i++)
+    {
+        queue.cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    queue.head.store(0, std::memory_order_relaxed);
+    queue.tail.store(0, std::memory_order_relaxed);
+}
+
+b4 push_job(JobQueue &queue, const StreamJob &job)
+{
+    u4 pos = queue.head.load(std::memory_order_relaxed);
+    while (1)
+    {
+        JobQueue::Cell &cell = queue.cells[pos & (STREAM_QUEUE_SIZE - 1)];
+        u4 sequence = cell.sequence.load(std::memory_order_acquire);
+        s4 diff = (s4)(sequence - pos);
+        if (diff == 0)
+        {
+            if (queue.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                cell.job = job;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // full
+        }
+        else
+        {
+            pos = queue.head.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+b4 pop_job(JobQueue &queue, StreamJob &job)
+{
+    u4 pos = queue.tail.load(std::memory_order_relaxed);
+    while (1)
+    {
+        JobQueue::Cell &cell = queue.cells[pos & (STREAM_QUEUE_SIZE - 1)];
+        u4 sequence = cell.sequence.load(std::memory_order_acquire);
+        s4 diff = (s4)(sequence - (pos + 1));
+        if (diff == 0)
+        {
+            if (queue.tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                job = cell.job;
+                cell.sequence.store(pos + STREAM_QUEUE_SIZE, std::memory_order_release);
+                return true;
+            }
+        }
+        else if (diff < 0)
+        {
+            return false; // empty
+        }
+        else
+        {
+            pos = queue.tail.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+struct Streaming
+{
+    JobQueue requests;
+    JobQueue ready;
+
+    std::thread workers[STREAM_MAX_WORKERS];
+    GameMemory arenas[STREAM_MAX_WORKERS];
+    u4 worker_count;
+    std::atomic<b4> running;
+
+    // only to let idle workers sleep, the queues don't need it
+    std::mutex wake_lock;
+    std::condition_variable wake;
+
+    u4 pending; // GL thread only
+} streaming;
+
+/*
+    Worker side
+*/
+// one parser thread by default, the workers are already spread over the cores
+void stream_mesh(StreamJob &job, GameMemory &arena, u4 parse_threads = 1)
+{
+    uint64_t start = permanent_mark(arena);
+    job.ok = load_mesh_data(job.name, arena, job.mesh, job.mapping, parse_threads);
+
+    u8 size = permanent_mark(arena) - start;
+    if (job.ok && size)
+    {
+        // parsed into the arena, which the next job reuses: move everything into one block
+        u1* from = (u1*)arena.PermanentStorage + start;
+        u1* to = (u1*)malloc(size);
+        if (!to)
+        {
+            job.ok = false;
+            release_permanent(arena, start);
+            return;
+        }
+        memcpy(to, from, size);
+        job.mesh_block = to;
+        job.mesh.vertices = (glm::vec3*)(to + ((u1*)job.mesh.vertices - from));
+        job.mesh.uvs      = (glm::vec2*)(to + ((u1*)job.mesh.uvs - from));
+        job.mesh.normals  = (glm::vec3*)(to + ((u1*)job.mesh.normals - from));
+        job.mesh.indices  = (u4*)(to + ((u1*)job.mesh.indices - from));
+        if (job.mesh.hull_vertex_count)
+        {
+            job.mesh.hull_vertices = (glm::vec3*)(to + ((u1*)job.mesh.hull_vertices - from));
+            job.mesh.hull_indices  = (u4*)(to + ((u1*)job.mesh.hull_indices - from));
+        }
+    }
+    release_permanent(arena, start);
+
+    job.bytes = (u8)job.mesh.vertex_count * (sizeof(glm::vec3) + sizeof(glm::vec2))
+              + (u8)job.mesh.index_count * sizeof(u4);
+}
+
+void stream_texture(StreamJob &job, GameMemory &arena)
+{
+    job.ok = load_texture_data(job.name, job.components, job.texture, job.mapping, job.decoded);
+    job.bytes = 0;
+    for (u4 level = 0; job.ok && level < job.texture.level_count; level++)
+    {
+        job.bytes += job.texture.level_size[level];
+    }
+}
+
+void stream_worker(u4 index)
+{
+    GameMemory &arena = streaming.arenas[index];
+    StreamJob job;
+
+    while (streaming.running.load())
+    {
+        if (!pop_job(streaming.requests, job))
+        {
+            std::unique_lock<std::mutex> lock(streaming.wake_lock);
+            streaming.wake.wait_for(lock, std::chrono::milliseconds(10));
+            continue;
+        }
+
+        if (job.type == STREAM_MESH) stream_mesh(job, arena);
+        else                         stream_texture(job, arena);
+        release_transient(arena, 0);
+
+        // the GL thread drains this every frame, wait for room
+        while (!push_job(streaming.ready, job))
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    }
+}
+
+/*
+    One worker per core, less the GL thread. Decoding is CPU bound, so
+    more requests in flight than cores buys nothing.
+*/
+u4 default_worker_count()
+{
+    u4 cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 1;
+}
+
+void start_streaming(u4 worker_count = default_worker_count())
+{
+    init_queue(streaming.requests);
+    init_queue(streaming.ready);
+    streaming.pending = 0;
+    streaming.running.store(true);
+
+    if (worker_count < 1) worker_count = 1;
+    if (worker_count > STREAM_MAX_WORKERS) worker_count = STREAM_MAX_WORKERS;
+    streaming.worker_count = worker_count;
+    for (u4 i = 0; i < worker_count; i++)
+    {
+        initialize_memory(streaming.arenas[i], STREAM_ARENA_MEGABYTES, STREAM_ARENA_TRANSIENT_MEGABYTES);
+        streaming.workers[i] = std::thread(stream_worker, i);
+    }
+}
+
+/*
+    GL thread side
+*/
+void release_job(StreamJob &job)
+{
+    if (job.decoded) stbi_image_free(job.texture.levels[0]);
+    free(job.mesh_block);
+    unmap_file(job.mapping);
+}
+
+/*
+    A mesh that failed on a worker, maybe for lack of arena, gets one more
+    try on the GL thread in the bigger main arena. That frame stalls, but
+    only for meshes too big to stream.
+*/
+void retry_mesh_load(StreamJob &job)
+{
+    release_job(job);
+    job.mesh_block = 0;
+    job.mesh = {};
+
+    uint64_t start = transient_mark(memory);
+    stream_mesh(job, memory, 0);
+    release_transient(memory, start);
+}
+
+b4 queue_job(StreamJob &job)
+{
+    if (!push_job(streaming.requests, job)) return false;
+    streaming.pending++;
+    streaming.wake.notify_one();
+    return true;
+}
+
+Handle request_mesh (const char* filename)
+{
+    Handle existing = find_handle(handles, filename, HANDLE_MESH);
+    if (existing) return existing;
+
+    Library::Mesh* mesh = reserve_mesh(filename);
+    if (!mesh) return 0;
+
+    StreamJob job = {};
+    job.type = STREAM_MESH;
+    job.handle = mesh->handle;
+    job.slot = mesh;
+    job.name = mesh->name;
+    if (!queue_job(job))
+    {
+        cout << "Stream queue full, failed to request mesh: " << filename << endl;
+        abandon_asset(mesh->name, mesh->handle, HANDLE_MESH);
+        return 0;
+    }
+    return mesh->handle;
+}
+
+Handle request_texture (const char* filename, u4 components = 3)
+{
+    Handle existing = find_handle(handles, filename, HANDLE_TEXTURE);
+    if (existing) return existing;
+
+    Library::Texture* texture = reserve_texture(filename);
+    if (!texture) return 0;
+
+    StreamJob job = {};
+    job.type = STREAM_TEXTURE;
+    job.handle = texture->handle;
+    job.slot = texture;
+    job.name = texture->name;
+    job.components = components;
+    if (!queue_job(job))
+    {
+        cout << "Stream queue full, failed to request texture: " << filename << endl;
+        abandon_asset(texture->name, texture->handle, HANDLE_TEXTURE);
+        return 0;
+    }
+    return texture->handle;
+}
+
+/*
+    Loads an asset that is already uploaded again, for hot reloading. The
+    old GL objects keep drawing until the new ones are uploaded.
+*/
+b4 reload_mesh (Library::Mesh &mesh)
+{
+    StreamJob job = {};
+    job.type = STREAM_MESH;
+    job.handle = mesh.handle;
+    job.slot = &mesh;
+    job.name = mesh.name;
+    job.reload = true;
+    return queue_job(job);
+}
+
+b4 reload_texture (Library::Texture &texture)
+{
+    StreamJob job = {};
+    job.type = STREAM_TEXTURE;
+    job.handle = texture.handle;
+    job.slot = &texture;
+    job.name = texture.name;
+    job.components = texture_components(texture.format);
+    job.reload = true;
+    return queue_job(job);
+}
+
+/*
+    Call once per frame. Uploads finished loads until budget bytes have
+    gone to the GPU, at least one per call.
+*/
+void process_uploads (u8 budget)
+{
+    u8 uploaded = 0;
+    StreamJob job;
+    while (uploaded < budget && pop_job(streaming.ready, job))
+    {
+        streaming.pending--;
+
+        if (job.type == STREAM_MESH)
+        {
+            Library::Mesh &mesh = *(Library::Mesh*)job.slot;
+            b4 current = valid_handle(handles, job.handle, HANDLE_MESH) && mesh.handle == job.handle;
+            if (current && !job.ok) retry_mesh_load(job);
+
+            // finish_mesh replaces these, unless it fails and a reload keeps them
+            Library::Mesh old = mesh;
+            if (current && job.ok)
+            {
+                mesh.data = job.mesh;
+                if (!finish_mesh(mesh))
+                {
+                    mesh.data = old.data;
+                    job.ok = false;
+                }
+            }
+
+            if (!current)
+            {
+                // unloaded meanwhile, the slot may hold another asset by now
+            }
+            else if (!job.ok && job.reload)
+            {
+                cout << "Failed to reload mesh, keeping the old one: " << job.name << endl;
+            }
+            else if (!job.ok)
+            {
+                cout << "Failed to load mesh: " << job.name << endl;
+                abandon_asset(mesh.name, job.handle, HANDLE_MESH);
+                mesh.handle = 0;
+            }
+            else
+            {
+                if (job.reload)
+                {
+                    delete_vertex_array(old.vertex_array);
+                    delete_buffer(old.vertex_buffer);
+                    delete_buffer(old.index_buffer);
+                }
+                keep_hull(mesh);
+                mesh.data.vertices = 0;
+                mesh.data.uvs = 0;
+                mesh.data.normals = 0;
+                mesh.data.indices = 0;
+                if (job.reload) refresh_mesh_bodies(&mesh.data);
+            }
+        }
+        else
+        {
+            Library::Texture &texture = *(Library::Texture*)job.slot;
+            if (!valid_handle(handles, job.handle, HANDLE_TEXTURE) || texture.handle != job.handle)
+            {
+                // unloaded meanwhile, the slot may hold another asset by now
+            }
+            else if (!job.ok && job.reload)
+            {
+                cout << "Failed to reload texture, keeping the old one: " << job.name << endl;
+            }
+            else if (!job.ok)
+            {
+                cout << "Failed to load texture: " << job.name << endl;
+                abandon_asset(texture.name, job.handle, HANDLE_TEXTURE);
+                texture.handle = 0;
+            }
+            else
+            {
+                if (!job.reload || !replace_texture_layer(texture, job.texture))
+                {
+                    // a packed texture whose layout changed leaves its old layer unused
+                    if (job.reload && !texture_id_shared(texture.id, &texture))
+                    {
+                        delete_texture(texture.id);
+                    }
+                    finish_texture(texture, job.texture);
+                }
+            }
+        }
+
+        release_job(job);
+        uploaded += job.bytes;
+    }
+}
+
+inline b4 streaming_idle ()
+{
+    return streaming.pending == 0;
+}
+
+void stop_streaming ()
+{
+    streaming.running.store(false);
+    streaming.wake.notify_all();
+    for (u4 i = 0; i < streaming.worker_count; i++)
+    {
+        streaming.workers[i].join();
+        free(streaming.arenas[i].PermanentStorage);
+        free(streaming.arenas[i].TransientStorage);
+    }
+    streaming.worker_count = 0;
+
+    StreamJob job;
+    while (pop_job(streaming.ready, job)) release_job(job);
+    while (pop_job(streaming.requests, job)) {}
+    streaming.pending = 0;
+}
@@ -0,0 +1,239 @@
+/*
+    Texture arrays
+
+    With GL 3.0 or EXT_texture_array every texture is uploaded as a
+    GL_TEXTURE_2D_ARRAY, a single layer to begin with. pack_textures then
+    merges the arrays of textures that share format, size and mip count
+    into one, so entities with different textures draw with the same
+    binding and only a different tex_layer uniform. basic_texture.f.glsl
+    is compiled with TEXTURE_ARRAY defined to sample them.
+
+    Merging reads every level back with glGetTexImage and writes it into
+    the new array. That is a one off cost, paid after loading settles.
+    Without array support textures stay plain GL_TEXTURE_2D, layer 0.
+*/
+
+global_variable b4 texture_arrays = false;
+global_variable u4 texture_uploads = 0; // new uploads are unpacked, see pack_textures
+
+inline GLenum texture_target()
+{
+    return texture_arrays ? GL_TEXTURE_2D_ARRAY : GL_TEXTURE_2D;
+}
+
+// internal format and, for uncompressed ones, the pixel format too
+inline GLenum texture_gl_format(u4 format)
+{
+    switch (format)
+    {
+        case TEXTURE_RGBA8: return GL_RGBA;
+        case TEXTURE_BC1:   return GL_COMPRESSED_RGB_S3TC_DXT1_EXT;
+        case TEXTURE_BC3:   return GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+    }
+    return GL_RGB;
+}
+
+inline b4 same_texture_layout(Library::Texture &a, Library::Texture &b)
+{
+    return a.format == b.format && a.width == b.width && a.height == b.height && a.level_count == b.level_count;
+}
+
+// Textures share a GL texture once packed, only the last one out deletes it
+b4 texture_id_shared(GLuint id, Library::Texture* except)
+{
+    for (u4 i = 0; i < library.texture_count; i++)
+    {
+        Library::Texture &other = library.textures[i];
+        if (&other != except && other.handle && other.id == id) return true;
+    }
+    return false;
+}
+
+/*
+    Reloads a texture that shares an array into its own layer, as long as
+    format, size and mip count are unchanged. Then the array has no dead
+    layer and there is nothing new for pack_textures. False otherwise.
+*/
+b4 replace_texture_layer(Library::Texture &texture, TextureData &data)
+{
+    if (!texture_arrays || !texture_id_shared(texture.id, &texture)) return false;
+    if (data.format != texture.format || data.width != texture.width || data.height != texture.height
+        || data.level_count != texture.level_count) return false;
+
+    GLenum format = texture_gl_format(data.format);
+    bind_texture(GL_TEXTURE_2D_ARRAY, texture.id);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (u4 level = 0; level < data.level_count; level++)
+    {
+        u4 w = level_dimension(data.width, level);
+        u4 h = level_dimension(data.height, level);
+        if (compressed_format(data.format))
+        {
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, texture.layer, w, h, 1,
+                format, (GLsizei)data.level_size[level], data.levels[level]);
+        }
+        else
+        {
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, texture.layer, w, h, 1,
+                format, GL_UNSIGNED_BYTE, data.levels[level]);
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    return true;
+}
+
+inline u4 texture_array_layers(GLuint id)
+{
+    GLint depth = 0;
+    bind_texture(GL_TEXTURE_2D_ARRAY, id);
+    glGetTexLevelParameteriv(GL_TEXTURE_2D_ARRAY, 0, GL_TEXTURE_DEPTH, &depth);
+    return (u4)depth;
+}
+
+/*
+    Merges the arrays of every group of same layout textures into one.
+    Textures still loading (id 0) are left for the next call. Returns
+    how many textures moved.
+*/
+u4 pack_textures()
+{
+    if (!texture_arrays) return 0;
+
+    GLint max_layers = 0;
+    glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &max_layers);
+
+    uint64_t start = transient_mark(memory);
+    b4* grouped = (b4*)alloc_transient(memory, sizeof(b4) * (u8)library.texture_count);
+    GLuint* sources = (GLuint*)alloc_transient(memory, sizeof(GLuint) * (u8)library.texture_count);
+    u4* source_layers = (u4*)alloc_transient(memory, sizeof(u4) * (u8)library.texture_count);
+    if (!grouped || !sources || !source_layers)
+    {
+        release_transient(memory, start);
+        return 0;
+    }
+    memset(grouped, 0, sizeof(b4) * (u8)library.texture_count);
+
+    u4 moved = 0;
+    for (u4 i = 0; i < library.texture_count; i++)
+    {
+        Library::Texture &first = library.textures[i];
+        if (grouped[i] || !first.handle || !first.id) continue;
+
+        // distinct arrays holding this layout, as many as fit in one
+        u4 source_count = 0;
+        u4 total_layers = 0;
+        for (u4 j = i; j < library.texture_count; j++)
+        {
+            Library::Texture &texture = library.textures[j];
+            if (grouped[j] || !texture.handle || !texture.id || !same_texture_layout(first, texture)) continue;
+
+            b4 known = false;
+            for (u4 s = 0; s < source_count && !known; s++) known = sources[s] == texture.id;
+            if (known)
+            {
+                grouped[j] = true;
+                continue;
+            }
+
+            // doesn't fit, left for a later group
+            u4 layers = texture_array_layers(texture.id);
+            if (total_layers + layers > (u4)max_layers) continue;
+            grouped[j] = true;
+            sources[source_count] = texture.id;
+            source_layers[source_count] = layers;
+            source_count++;
+            total_layers += layers;
+        }
+        if (source_count < 2) continue;
+
+        GLenum format = texture_gl_format(first.format);
+        b4 compressed = compressed_format(first.format);
+
+        GLuint packed;
+        glGenTextures(1, &packed);
+        bind_texture(GL_TEXTURE_2D_ARRAY, packed);
+        for (u4 level = 0; level < first.level_count; level++)
+        {
+            u4 w = level_dimension(first.width, level);
+            u4 h = level_dimension(first.height, level);
+            if (compressed)
+            {
+                glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, w, h, total_layers,
+                    0, (GLsizei)(texture_level_size(first.format, w, h) * total_layers), 0);
+            }
+            else
+            {
+                glTexImage3D(GL_TEXTURE_2D_ARRAY, level, format, w, h, total_layers,
+                    0, format, GL_UNSIGNED_BYTE, 0);
+            }
+        }
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, first.level_count - 1);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+
+        // level 0 of the biggest source is the most that is ever in flight
+        u8 largest = 0;
+        for (u4 s = 0; s < source_count; s++)
+        {
+            u8 size = texture_level_size(first.format, first.width, first.height) * source_layers[s];
+            if (size > largest) largest = size;
+        }
+        u1* pixels = (u1*)malloc(largest);
+        if (!pixels)
+        {
+            // the sources stay as they are, the next call tries again
+            cout << "Out of memory packing " << first.width << "x" << first.height << " textures" << endl;
+            delete_texture(packed);
+            continue;
+        }
+
+        glPixelStorei(GL_PACK_ALIGNMENT, 1);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        u4 offset = 0;
+        u4 group_moved = 0;
+        for (u4 s = 0; s < source_count; s++)
+        {
+            for (u4 level = 0; level < first.level_count; level++)
+            {
+                u4 w = level_dimension(first.width, level);
+                u4 h = level_dimension(first.height, level);
+                bind_texture(GL_TEXTURE_2D_ARRAY, sources[s]);
+                if (compressed) glGetCompressedTexImage(GL_TEXTURE_2D_ARRAY, level, pixels);
+                else            glGetTexImage(GL_TEXTURE_2D_ARRAY, level, format, GL_UNSIGNED_BYTE, pixels);
+                bind_texture(GL_TEXTURE_2D_ARRAY, packed);
+                if (compressed)
+                {
+                    glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, offset, w, h, source_layers[s],
+                        format, (GLsizei)(texture_level_size(first.format, w, h) * source_layers[s]), pixels);
+                }
+                else
+                {
+                    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, level, 0, 0, offset, w, h, source_layers[s],
+                        format, GL_UNSIGNED_BYTE, pixels);
+                }
+            }
+
+            for (u4 j = i; j < library.texture_count; j++)
+            {
+                Library::Texture &texture = library.textures[j];
+                if (!texture.handle || texture.id != sources[s]) continue;
+                texture.id = packed;
+                texture.layer += offset;
+                group_moved++;
+            }
+            delete_texture(sources[s]);
+            offset += source_layers[s];
+        }
+        glPixelStorei(GL_PACK_ALIGNMENT, 4);
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        free(pixels);
+        moved += group_moved;
+
+        printf("Packed %u textures (%ux%u) into one array of %u layers\n", group_moved, first.width, first.height, total_layers);
+    }
+
+    release_transient(memory, start);
+    return moved;
+}
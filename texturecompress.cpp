@@ -0,0 +1,381 @@
+/*
+    Block compression
+
+    Encodes RGB mip chains to BC1 (DXT1, 8 bytes per 4x4 block, 6:1
+    against RGB8) and RGBA ones to BC3 (DXT5, 16 bytes per block, 4:1),
+    which every desktop GPU with EXT_texture_compression_s3tc samples
+    directly.
+
+    Colors: endpoints along the principal axis of the block's colors,
+    pulled in a little to cut the error at the ends, then one least
+    squares refit from the chosen indices, kept if it is better. Picking
+    the nearest of the 4 palette colors is done 4 pixels at a time with
+    SSE2 where available.
+    Alpha: min and max of the block with 6 interpolated values between.
+
+    Blocks are independent, compress_texture spreads block rows of all
+    levels over threads.
+*/
+
+struct ColorBlock
+{
+    // structure of arrays for the SIMD distance loop
+    f4 r[16];
+    f4 g[16];
+    f4 b[16];
+    u1 a[16];
+};
+
+inline u2 pack_565(const f4 c[3])
+{
+    s4 r = (s4)(c[0] * (31.0f / 255.0f) + 0.5f);
+    s4 g = (s4)(c[1] * (63.0f / 255.0f) + 0.5f);
+    s4 b = (s4)(c[2] * (31.0f / 255.0f) + 0.5f);
+    r = r < 0 ? 0 : (r > 31 ? 31 : r);
+    g = g < 0 ? 0 : (g > 63 ? 63 : g);
+    b = b < 0 ? 0 : (b > 31 ? 31 : b);
+    return (u2)((r << 11) | (g << 5) | b);
+}
+
+// what the GPU expands it to
+inline void unpack_565(u2 c, f4 out[3])
+{
+    u4 r = (c >> 11) & 31;
+    u4 g = (c >> 5) & 63;
+    u4 b = c & 31;
+    out[0] = (f4)((r << 3) | (r >> 2));
+    out[1] = (f4)((g << 2) | (g >> 4));
+    out[2] = (f4)((b << 3) | (b >> 2));
+}
+
+void load_block(const u1* pixels, u4 width, u4 height, u4 components, u4 block_x, u4 block_y, ColorBlock &block)
+{
+    for (u4 y = 0; y < 4; y++)
+    {
+        // edge blocks repeat the last row and column
+        u4 py = block_y * 4 + y < height ? block_y * 4 + y : height - 1;
+        for (u4 x = 0; x < 4; x++)
+        {
+            u4 px = block_x * 4 + x < width ? block_x * 4 + x : width - 1;
+            const u1* p = pixels + ((u8)py * width + px) * components;
+            u4 i = y * 4 + x;
+            block.r[i] = p[0];
+            block.g[i] = p[1];
+            block.b[i] = p[2];
+            block.a[i] = components == 4 ? p[3] : 255;
+        }
+    }
+}
+
+/*
+    Nearest palette entry for every pixel, returns the total squared error
+*/
+f4 select_color_indices(const ColorBlock &block, const f4 palette[4][3], u1 indices[16])
+{
+    f4 total = 0.0f;
+#ifdef __SSE2__
+    for (u4 i = 0; i < 16; i += 4)
+    {
+        __m128 r = _mm_loadu_ps(block.r + i);
+        __m128 g = _mm_loadu_ps(block.g + i);
+        __m128 b = _mm_loadu_ps(block.b + i);
+
+        __m128 best = _mm_set1_ps(1e30f);
+        __m128i best_index = _mm_setzero_si128();
+        for (u4 p = 0; p < 4; p++)
+        {
+            __m128 dr = _mm_sub_ps(r, _mm_set1_ps(palette[p][0]));
+            __m128 dg = _mm_sub_ps(g, _mm_set1_ps(palette[p][1]));
+            __m128 db = _mm_sub_ps(b, _mm_set1_ps(palette[p][2]));
+            __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dr, dr), _mm_mul_ps(dg, dg)), _mm_mul_ps(db, db));
+
+            __m128 closer = _mm_cmplt_ps(d, best);
+            best = _mm_or_ps(_mm_and_ps(closer, d), _mm_andnot_ps(closer, best));
+            __m128i mask = _mm_castps_si128(closer);
+            best_index = _mm_or_si128(_mm_and_si128(mask, _mm_set1_epi32(p)), _mm_andnot_si128(mask, best_index));
+        }
+
+        alignas(16) f4 errors[4];
+        alignas(16) s4 chosen[4];
+        _mm_store_ps(errors, best);
+        _mm_store_si128((__m128i*)chosen, best_index);
+        for (u4 k = 0; k < 4; k++)
+        {
+            indices[i + k] = (u1)chosen[k];
+            total += errors[k];
+        }
+    }
+#else
+    for (u4 i = 0; i < 16; i++)
+    {
+        f4 best = 1e30f;
+        for (u4 p = 0; p < 4; p++)
+        {
+            f4 dr = block.r[i] - palette[p][0];
+            f4 dg = block.g[i] - palette[p][1];
+            f4 db = block.b[i] - palette[p][2];
+            f4 d = dr * dr + dg * dg + db * db;
+            if (d < best)
+            {
+                best = d;
+                indices[i] = (u1)p;
+            }
+        }
+        total += best;
+    }
+#endif
+    return total;
+}
+
+/*
+    Orders the endpoints for 4 color mode (c0 > c1) and builds the palette.
+    False if they quantized to the same color.
+*/
+b4 color_palette(u2 &c0, u2 &c1, f4 palette[4][3])
+{
+    if (c0 < c1)
+    {
+        u2 t = c0;
+        c0 = c1;
+        c1 = t;
+    }
+    unpack_565(c0, palette[0]);
+    unpack_565(c1, palette[1]);
+    for (u4 k = 0; k < 3; k++)
+    {
+        palette[2][k] = (2.0f * palette[0][k] + palette[1][k]) / 3.0f;
+        palette[3][k] = (palette[0][k] + 2.0f * palette[1][k]) / 3.0f;
+    }
+    return c0 != c1;
+}
+
+inline void write_color_block(u2 c0, u2 c1, const u1 indices[16], u1* out)
+{
+    u4 bits = 0;
+    for (u4 i = 0; i < 16; i++) bits |= (u4)indices[i] << (i * 2);
+    out[0] = (u1)(c0 & 0xFF);
+    out[1] = (u1)(c0 >> 8);
+    out[2] = (u1)(c1 & 0xFF);
+    out[3] = (u1)(c1 >> 8);
+    out[4] = (u1)(bits & 0xFF);
+    out[5] = (u1)((bits >> 8) & 0xFF);
+    out[6] = (u1)((bits >> 16) & 0xFF);
+    out[7] = (u1)(bits >> 24);
+}
+
+void encode_color_block(const ColorBlock &block, u1* out)
+{
+    f4 mean[3] = {};
+    for (u4 i = 0; i < 16; i++)
+    {
+        mean[0] += block.r[i];
+        mean[1] += block.g[i];
+        mean[2] += block.b[i];
+    }
+    for (u4 k = 0; k < 3; k++) mean[k] /= 16.0f;
+
+    // covariance: rr gg bb rg rb gb
+    f4 cov[6] = {};
+    for (u4 i = 0; i < 16; i++)
+    {
+        f4 r = block.r[i] - mean[0];
+        f4 g = block.g[i] - mean[1];
+        f4 b = block.b[i] - mean[2];
+        cov[0] += r * r; cov[1] += g * g; cov[2] += b * b;
+        cov[3] += r * g; cov[4] += r * b; cov[5] += g * b;
+    }
+
+    // principal axis by power iteration, a handful of steps is plenty for 3x3
+    f4 axis[3] = { 1.0f, 1.0f, 1.0f };
+    for (u4 step = 0; step < 6; step++)
+    {
+        f4 x = cov[0] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2];
+        f4 y = cov[3] * axis[0] + cov[1] * axis[1] + cov[5] * axis[2];
+        f4 z = cov[4] * axis[0] + cov[5] * axis[1] + cov[2] * axis[2];
+        f4 largest = fmaxf(fabsf(x), fmaxf(fabsf(y), fabsf(z)));
+        if (largest < 1e-6f) break; // flat block
+        axis[0] = x / largest;
+        axis[1] = y / largest;
+        axis[2] = z / largest;
+    }
+
+    f4 low = 1e30f, high = -1e30f;
+    for (u4 i = 0; i < 16; i++)
+    {
+        f4 t = (block.r[i] - mean[0]) * axis[0] + (block.g[i] - mean[1]) * axis[1] + (block.b[i] - mean[2]) * axis[2];
+        low = fminf(low, t);
+        high = fmaxf(high, t);
+    }
+    f4 inset = (high - low) / 16.0f;
+    low += inset;
+    high -= inset;
+
+    f4 end0[3], end1[3];
+    for (u4 k = 0; k < 3; k++)
+    {
+        end0[k] = mean[k] + axis[k] * high;
+        end1[k] = mean[k] + axis[k] * low;
+    }
+
+    u2 c0 = pack_565(end0);
+    u2 c1 = pack_565(end1);
+    f4 palette[4][3];
+    u1 indices[16] = {};
+    if (!color_palette(c0, c1, palette))
+    {
+        write_color_block(c0, c1, indices, out);
+        return;
+    }
+    f4 error = select_color_indices(block, palette, indices);
+
+    /*
+        Refit: with the indices fixed, each pixel is w*c0 + (1-w)*c1, solve
+        for the c0 and c1 that minimize the squared error
+    */
+    static const f4 weight[4] = { 1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f };
+    f4 aa = 0.0f, bb = 0.0f, ab = 0.0f;
+    f4 ax[3] = {}, bx[3] = {};
+    for (u4 i = 0; i < 16; i++)
+    {
+        f4 a = weight[indices[i]];
+        f4 b = 1.0f - a;
+        aa += a * a;
+        bb += b * b;
+        ab += a * b;
+        ax[0] += a * block.r[i]; ax[1] += a * block.g[i]; ax[2] += a * block.b[i];
+        bx[0] += b * block.r[i]; bx[1] += b * block.g[i]; bx[2] += b * block.b[i];
+    }
+    f4 det = aa * bb - ab * ab;
+    if (fabsf(det) > 1e-6f)
+    {
+        for (u4 k = 0; k < 3; k++)
+        {
+            end0[k] = (ax[k] * bb - bx[k] * ab) / det;
+            end1[k] = (bx[k] * aa - ax[k] * ab) / det;
+        }
+        u2 r0 = pack_565(end0);
+        u2 r1 = pack_565(end1);
+        f4 refit_palette[4][3];
+        u1 refit_indices[16];
+        if (color_palette(r0, r1, refit_palette))
+        {
+            f4 refit_error = select_color_indices(block, refit_palette, refit_indices);
+            if (refit_error < error)
+            {
+                c0 = r0;
+                c1 = r1;
+                memcpy(indices, refit_indices, sizeof(indices));
+            }
+        }
+    }
+
+    write_color_block(c0, c1, indices, out);
+}
+
+void encode_alpha_block(const ColorBlock &block, u1* out)
+{
+    u1 a0 = 0, a1 = 255;
+    for (u4 i = 0; i < 16; i++)
+    {
+        if (block.a[i] > a0) a0 = block.a[i];
+        if (block.a[i] < a1) a1 = block.a[i];
+    }
+
+    // 8 value mode (a0 > a1): the ends and 6 steps between
+    f4 palette[8];
+    palette[0] = a0;
+    palette[1] = a1;
+    for (u4 k = 1; k < 7; k++) palette[k + 1] = ((7 - k) * a0 + k * a1) / 7.0f;
+
+    u8 bits = 0;
+    if (a0 != a1)
+    {
+        for (u4 i = 0; i < 16; i++)
+        {
+            u4 best_index = 0;
+            f4 best = 1e30f;
+            for (u4 p = 0; p < 8; p++)
+            {
+                f4 d = fabsf(block.a[i] - palette[p]);
+                if (d < best)
+                {
+                    best = d;
+                    best_index = p;
+                }
+            }
+            bits |= (u8)best_index << (i * 3);
+        }
+    }
+
+    out[0] = a0;
+    out[1] = a1;
+    for (u4 k = 0; k < 6; k++) out[2 + k] = (u1)((bits >> (k * 8)) & 0xFF);
+}
+
+/*
+    Compresses every level of an RGB8/RGBA8 texture, RGB to BC1 and RGBA to
+    BC3. The levels go to transient memory. False if they don't fit.
+*/
+b4 compress_texture(const TextureData &in, GameMemory &memory, u4 thread_count, TextureData &out)
+{
+    out = {};
+    out.format = in.format == TEXTURE_RGBA8 ? TEXTURE_BC3 : TEXTURE_BC1;
+    out.width = in.width;
+    out.height = in.height;
+    out.level_count = in.level_count;
+
+    u4 row_start[TEXTURE_MAX_LEVELS + 1];
+    u4 total_rows = 0;
+    for (u4 level = 0; level < in.level_count; level++)
+    {
+        u4 w = level_dimension(in.width, level);
+        u4 h = level_dimension(in.height, level);
+        out.level_size[level] = texture_level_size(out.format, w, h);
+        out.levels[level] = (u1*)alloc_transient(memory, out.level_size[level]);
+        if (!out.levels[level]) return false;
+        row_start[level] = total_rows;
+        total_rows += (h + 3) / 4;
+    }
+    row_start[in.level_count] = total_rows;
+
+    // threads take block rows, across all levels, until none are left
+    std::atomic<u4> next_row(0);
+    auto work = [&] ()
+    {
+        u4 components = texture_components(in.format);
+        u4 block_size = out.format == TEXTURE_BC1 ? BC1_BLOCK_SIZE : BC3_BLOCK_SIZE;
+        ColorBlock block;
+        for (u4 row = next_row++; row < total_rows; row = next_row++)
+        {
+            u4 level = 0;
+            while (row >= row_start[level + 1]) level++;
+            u4 w = level_dimension(in.width, level);
+            u4 h = level_dimension(in.height, level);
+            u4 blocks_x = (w + 3) / 4;
+            u4 block_y = row - row_start[level];
+
+            u1* dst = out.levels[level] + (u8)block_y * blocks_x * block_size;
+            for (u4 block_x = 0; block_x < blocks_x; block_x++, dst += block_size)
+            {
+                load_block(in.levels[level], w, h, components, block_x, block_y, block);
+                if (out.format == TEXTURE_BC3)
+                {
+                    encode_alpha_block(block, dst);
+                    encode_color_block(block, dst + 8);
+                }
+                else
+                {
+                    encode_color_block(block, dst);
+                }
+            }
+        }
+    };
+
+    if (thread_count < 1) thread_count = 1;
+    if (thread_count > 16) thread_count = 16;
+    std::thread threads[16];
+    for (u4 i = 1; i < thread_count; i++) threads[i] = std::thread(work);
+    work();
+    for (u4 i = 1; i < thread_count; i++) threads[i].join();
+    return true;
+}
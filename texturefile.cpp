@@ -0,0 +1,369 @@
+/*
+    Raw texture files
+
+    A decoded image together with its whole mip chain, written by
+    assetbake as baked/<path>.png.tex. The runtime maps the file and
+    uploads each level straight from the mapping, so there is no PNG
+    decode and no glGenerateMipmap at startup. Textures nobody baked get
+    the same file written next to the source (<name>.png.tex) the first
+    time they are loaded, like the mesh cache.
+
+    Layout: TextureFileHeader, then each level at a 16 byte aligned
+    offset, largest first. Rows are tightly packed.
+*/
+
+#define TEXTURE_FILE_MAGIC 0x52584554u // "TEXR"
+#define TEXTURE_FILE_VERSION 2 // 2: block compressed formats
+#define TEXTURE_MAX_LEVELS 16
+
+enum TEXTURE_FORMATS {
+    TEXTURE_RGB8 = 0,
+    TEXTURE_RGBA8,
+    TEXTURE_BC1, // see texturecompress.cpp
+    TEXTURE_BC3,
+};
+
+#define BC1_BLOCK_SIZE 8
+#define BC3_BLOCK_SIZE 16
+
+// set by the runtime when the GPU takes BC1/BC3, otherwise compressed files are skipped
+global_variable b4 texture_compression = false;
+
+struct TextureFileHeader
+{
+    u4 magic;
+    u4 version;
+
+    // source image this was built from
+    u8 source_mtime;
+    u8 source_size;
+    u8 source_hash;
+
+    u4 format;
+    u4 width;
+    u4 height;
+    u4 level_count;
+
+    u8 level_offset[TEXTURE_MAX_LEVELS];
+    u8 level_size[TEXTURE_MAX_LEVELS];
+    u8 file_size;
+};
+
+struct TextureData
+{
+    u4 format;
+    u4 width;
+    u4 height;
+    u4 level_count;
+    u1* levels[TEXTURE_MAX_LEVELS];
+    u8 level_size[TEXTURE_MAX_LEVELS];
+};
+
+inline u4 texture_components(u4 format) { return format == TEXTURE_RGBA8 || format == TEXTURE_BC3 ? 4 : 3; }
+inline u4 level_dimension(u4 size, u4 level) { u4 r = size >> level; return r ? r : 1; }
+inline b4 compressed_format(u4 format) { return format == TEXTURE_BC1 || format == TEXTURE_BC3; }
+
+// bytes of one level, compressed formats round up to whole 4x4 blocks
+inline u8 texture_level_size(u4 format, u4 width, u4 height)
+{
+    if (!compressed_format(format)) return (u8)width * height * texture_components(format);
+    u8 blocks = (u8)((width + 3) / 4) * ((height + 3) / 4);
+    return blocks * (format == TEXTURE_BC1 ? BC1_BLOCK_SIZE : BC3_BLOCK_SIZE);
+}
+
+u4 mip_level_count(u4 width, u4 height)
+{
+    u4 levels = 1;
+    while ((width > 1 || height > 1) && levels < TEXTURE_MAX_LEVELS)
+    {
+        width = width > 1 ? width / 2 : 1;
+        height = height > 1 ? height / 2 : 1;
+        levels++;
+    }
+    return levels;
+}
+
+/*
+    Box filters each level down from the previous one. Odd sizes clamp
+    at the edge. All levels are malloc'd back to back, a big image's chain
+    doesn't fit in a transient arena, level 0 is copied from pixels.
+    Free it with free_mip_chain. False if out of memory.
+*/
+b4 build_mip_chain(const u1* pixels, u4 width, u4 height, u4 format, TextureData &out)
+{
+    u4 comp = texture_components(format);
+    out = {};
+    out.format = format;
+    out.width = width;
+    out.height = height;
+    out.level_count = mip_level_count(width, height);
+
+    u8 chain_size = 0;
+    for (u4 level = 0; level < out.level_count; level++)
+    {
+        out.level_size[level] = (u8)level_dimension(width, level) * level_dimension(height, level) * comp;
+        chain_size += out.level_size[level];
+    }
+    u1* chain = (u1*)malloc(chain_size);
+    if (!chain) return false;
+
+    for (u4 level = 0; level < out.level_count; level++)
+    {
+        u4 w = level_dimension(width, level);
+        u4 h = level_dimension(height, level);
+        out.levels[level] = chain;
+        chain += out.level_size[level];
+
+        if (level == 0)
+        {
+            memcpy(out.levels[0], pixels, out.level_size[0]);
+            continue;
+        }
+
+        const u1* src = out.levels[level - 1];
+        u4 sw = level_dimension(width, level - 1);
+        u4 sh = level_dimension(height, level - 1);
+        u1* dst = out.levels[level];
+
+        for (u4 y = 0; y < h; y++)
+        {
+            u4 y0 = y * 2 < sh ? y * 2 : sh - 1;
+            u4 y1 = y * 2 + 1 < sh ? y * 2 + 1 : sh - 1;
+            for (u4 x = 0; x < w; x++)
+            {
+                u4 x0 = x * 2 < sw ? x * 2 : sw - 1;
+                u4 x1 = x * 2 + 1 < sw ? x * 2 + 1 : sw - 1;
+                for (u4 c = 0; c < comp; c++)
+                {
+                    u4 sum = src[((u8)y0 * sw + x0) * comp + c]
+                           + src[((u8)y0 * sw + x1) * comp + c]
+                           + src[((u8)y1 * sw + x0) * comp + c]
+                           + src[((u8)y1 * sw + x1) * comp + c];
+                    dst[((u8)y * w + x) * comp + c] = (u1)((sum + 2) / 4);
+                }
+            }
+        }
+    }
+    return true;
+}
+
+inline void free_mip_chain(TextureData &chain)
+{
+    free(chain.levels[0]);
+    chain.levels[0] = 0;
+}
+
+b4 write_texture_file(const char* path, TextureData &texture, AssetSource &source)
+{
+    TextureFileHeader header = {};
+    header.magic = TEXTURE_FILE_MAGIC;
+    header.version = TEXTURE_FILE_VERSION;
+    header.source_mtime = source.mtime;
+    header.source_size = source.size;
+    header.source_hash = source_hash(source);
+    header.format = texture.format;
+    header.width = texture.width;
+    header.height = texture.height;
+    header.level_count = texture.level_count;
+
+    u8 offset = align16(sizeof(TextureFileHeader));
+    for (u4 level = 0; level < texture.level_count; level++)
+    {
+        header.level_offset[level] = offset;
+        header.level_size[level] = texture.level_size[level];
+        offset = align16(offset + texture.level_size[level]);
+    }
+    header.file_size = offset;
+
+    char temp[512];
+    snprintf(temp, sizeof(temp), "%s.tmp", path);
+    FILE* file = fopen(temp, "wb");
+    if (!file) return false;
+
+    static const u1 zeros[16] = {};
+    b4 ok = fwrite(&header, 1, sizeof(header), file) == sizeof(header);
+    u8 at = sizeof(header);
+    for (u4 level = 0; ok && level < texture.level_count; level++)
+    {
+        fwrite(zeros, 1, header.level_offset[level] - at, file);
+        ok = fwrite(texture.levels[level], 1, texture.level_size[level], file) == texture.level_size[level];
+        at = header.level_offset[level] + texture.level_size[level];
+    }
+    if (ok && at < header.file_size) fwrite(zeros, 1, header.file_size - at, file);
+    ok = (fclose(file) == 0) && ok;
+
+    if (!ok || rename(temp, path) != 0)
+    {
+        remove(temp);
+        return false;
+    }
+    return true;
+}
+
+/*
+    Points texture's levels into a texture file that is already in memory
+    (mapped on its own or inside the asset pack). If source is given, the
+    data is rejected unless it was built from that source.
+*/
+b4 parse_texture_file(const u1* data, u8 size, TextureData &texture, AssetSource* source = 0)
+{
+    TextureFileHeader header;
+    if (size < sizeof(header)) return false;
+    memcpy(&header, data, sizeof(header));
+
+    b4 ok = header.magic == TEXTURE_FILE_MAGIC
+         && header.version == TEXTURE_FILE_VERSION
+         && header.file_size == size
+         && header.format <= TEXTURE_BC3
+         && header.width >= 1 && header.height >= 1
+         && header.level_count >= 1
+         && header.level_count <= TEXTURE_MAX_LEVELS;
+    // the uploads trust each level to be exactly as big as its dimensions say
+    for (u4 level = 0; ok && level < header.level_count; level++)
+    {
+        u4 w = level_dimension(header.width, level);
+        u4 h = level_dimension(header.height, level);
+        ok = header.level_size[level] == texture_level_size(header.format, w, h)
+          && header.level_offset[level] <= size
+          && header.level_size[level] <= size - header.level_offset[level];
+    }
+
+    if (ok && source)
+    {
+        if (header.source_mtime != source->mtime || header.source_size != source->size)
+        {
+            ok = header.source_hash == source_hash(*source);
+        }
+    }
+    if (!ok) return false;
+
+    texture = {};
+    texture.format = header.format;
+    texture.width = header.width;
+    texture.height = header.height;
+    texture.level_count = header.level_count;
+    for (u4 level = 0; level < header.level_count; level++)
+    {
+        texture.levels[level] = (u1*)data + header.level_offset[level];
+        texture.level_size[level] = header.level_size[level];
+    }
+    return true;
+}
+
+/*
+    Maps a texture file and points texture's levels into the mapping
+*/
+b4 open_texture_file(const char* path, MappedFile &file, TextureData &texture, AssetSource* source = 0)
+{
+    if (!map_file(file, path)) return false;
+    if (!parse_texture_file(file.data, file.size, texture, source))
+    {
+        unmap_file(file);
+        return false;
+    }
+    return true;
+}
+
+void texture_file_path(const char* source, char* out, u4 out_size)
+{
+    snprintf(out, out_size, "%s.tex", source);
+}
+
+/*
+    Looks in the asset pack, then for a baked file, then in the texture
+    cache next to the source. On a hit texture points into the pack or
+    into mapping, which the caller unmaps after upload. On a miss the
+    image is decoded, its mip chain built and the
+    cache written and mapped, so the next run skips all of that.
+    Only if the cache can't be written does texture keep the single
+    decoded level: the caller frees it with stbi_image_free, decoded is
+    set, and the GPU builds the mips.
+*/
+b4 load_texture_data(const char* filename, u4 components, TextureData &texture, MappedFile &mapping, b4 &decoded)
+{
+    decoded = false;
+
+    char bake_path[512];
+    baked_path(filename, ".tex", bake_path, sizeof(bake_path));
+
+    char cache_path[512];
+    texture_file_path(filename, cache_path, sizeof(cache_path));
+
+    const u1* packed;
+    u8 packed_size;
+    b4 in_pack = find_in_pack(asset_pack, filename, PACK_TEXTURE, packed, packed_size);
+
+    // block compressed bakes are only any use if the GPU takes them
+    auto usable = [&] (b4 found) -> b4
+    {
+        if (found && compressed_format(texture.format) && !texture_compression)
+        {
+            unmap_file(mapping);
+            return false;
+        }
+        return found;
+    };
+
+    // a shipped pack is trusted without touching the source at all
+    if (usable(in_pack && !check_asset_sources && parse_texture_file(packed, packed_size, texture))) return true;
+
+    AssetSource source;
+    if (!get_asset_source(filename, source))
+    {
+        // shipped without the PNG, trust whatever was baked or cached
+        return usable(in_pack && parse_texture_file(packed, packed_size, texture))
+            || usable(open_texture_file(bake_path, mapping, texture))
+            || open_texture_file(cache_path, mapping, texture);
+    }
+
+    if (usable(in_pack && parse_texture_file(packed, packed_size, texture, &source))) return true;
+
+    if (usable(open_texture_file(bake_path, mapping, texture, &source))) return true;
+
+    u4 format = components == 4 ? TEXTURE_RGBA8 : TEXTURE_RGB8;
+    if (open_texture_file(cache_path, mapping, texture, &source))
+    {
+        if (texture.format == format)
+        {
+            // source was touched but not changed, store the new mtime so it isn't hashed every run
+            if (source.hashed) write_texture_file(cache_path, texture, source);
+            return true;
+        }
+        unmap_file(mapping); // cached with other components
+    }
+
+    cout << "No baked texture for " << filename << ", run assetbake" << endl;
+
+    int x, y, n;
+    u1* pixels = stbi_load(filename, &x, &y, &n, components);
+    if (!pixels) return false;
+
+    TextureData chain;
+    b4 cached = false;
+    if (build_mip_chain(pixels, (u4)x, (u4)y, format, chain))
+    {
+        cached = write_texture_file(cache_path, chain, source);
+        if (!cached) cout << "Failed to write texture cache: " << cache_path << endl;
+        free_mip_chain(chain);
+    }
+    else
+    {
+        cout << "Out of memory building mip chain: " << filename << endl;
+    }
+
+    if (cached && open_texture_file(cache_path, mapping, texture))
+    {
+        stbi_image_free(pixels);
+        return true;
+    }
+
+    texture = {};
+    texture.format = format;
+    texture.width = x;
+    texture.height = y;
+    texture.level_count = 1;
+    texture.levels[0] = pixels;
+    texture.level_size[0] = (u8)x * y * components;
+    decoded = true;
+    return true;
+}
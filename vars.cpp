@@ -10,12 +10,27 @@
 #include <stdio.h> // objloader.cpp
 #include <string> // objloader.cpp
 #include <cstring> // objloader.cpp
+#include <thread> // objloader.cpp, streaming.cpp
+#include <atomic> // streaming.cpp
+#include <mutex> // streaming.cpp
+#include <condition_variable> // streaming.cpp
+#include <chrono> // streaming.cpp
+#ifdef __linux__
+#include <sys/inotify.h> // hotreload.cpp
+#endif
+#ifdef __SSE__
+#include <xmmintrin.h> // render_functions.cpp
+#endif
 
 #include <SDL2/SDL.h>
 
 #define GLEW_STATIC
 #include <GL/glew.h>
 #include <SDL2/SDL_opengl.h>
+#ifdef SGL_HEADLESS
+#include <EGL/egl.h> // sgl.cpp
+#include <EGL/eglext.h>
+#endif
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -25,6 +40,8 @@
 #include "stb_image.h"
 
 #include "memory.h"
+#include "handles.h"
+#include "file_map.h"
 #include "math3D.h"
 
 #define DEBUG_BUILD
@@ -32,6 +49,13 @@
 using namespace std;
 
 #include "objectloader.cpp"
+#include "meshopt.cpp"
+#include "simplify.cpp"
+#include "hull.cpp"
+#include "packfile.cpp"
+#include "meshfile.cpp"
+#include "texturefile.cpp"
+#include "vertexformat.cpp"
 
 struct PRIMITIVE
 {
@@ -43,21 +67,65 @@ struct PRIMITIVE
 
 struct BASIC_TEXTURE_SHADER {
     GLuint program;
-    GLint uniform_model;
-    GLint uniform_view;
-    GLint uniform_proj;
-    GLint uniform_scale;
-    GLint uniform_rotation;
+    GLint uniform_mvp;   // proj * view * model, plain variant only
+    GLint uniform_model; // -1 while nothing shades with normals
     GLint uniform_tex_source;
+    GLint uniform_tex_layer; // -1 without texture arrays
+    GLint uniform_position_offset;
+    GLint uniform_position_scale;
     GLint attribute_coord3d;
     GLint attribute_tex_coord2d;
-} basic_texture;
+    GLint attribute_normal_oct; // -1 while nothing shades with normals
+    GLint attribute_instance_mvp; // instanced variant only
+    GLint attribute_instance_model;
+    GLint attribute_instance_layer;
+
+} basic_texture, basic_texture_instanced;
+
+// ARB_instanced_arrays and ARB_draw_instanced, see render_functions.cpp
+global_variable b4 instancing = false;
+
+// GL 3.0 or ARB_vertex_array_object, each mesh gets one, see finish_mesh
+global_variable b4 vertex_arrays = false;
+
+/*
+    Attribute locations, bound before linking so every basic_texture
+    variant agrees and one vertex array per mesh serves them all
+*/
+enum VERTEX_ATTRIBUTES {
+    ATTRIBUTE_COORD3D = 0,
+    ATTRIBUTE_NORMAL_OCT,
+    ATTRIBUTE_TEX_COORD2D,
+    ATTRIBUTE_INSTANCE_MVP,   // a mat4 takes four locations
+    ATTRIBUTE_INSTANCE_MODEL = ATTRIBUTE_INSTANCE_MVP + 4,
+    ATTRIBUTE_INSTANCE_LAYER = ATTRIBUTE_INSTANCE_MODEL + 4,
+};
+
+#define MESH_ATTRIBUTES ((1u << ATTRIBUTE_COORD3D) | (1u << ATTRIBUTE_NORMAL_OCT) | (1u << ATTRIBUTE_TEX_COORD2D))
+#define INSTANCE_ATTRIBUTES ((0xFFu << ATTRIBUTE_INSTANCE_MVP) | (1u << ATTRIBUTE_INSTANCE_LAYER))
+
+// per instance data of the instanced draws, see render_functions.cpp
+struct InstanceData
+{
+    glm::mat4 mvp;
+    glm::mat4 model;
+    f4 layer;
+};
+
+#define INSTANCE_STREAM_INSTANCES 4096 // per frame, see instance_stream
 
 struct SGL
 {
     SDL_Window* window;
     s4 width;
     s4 height;
+    GLuint framebuffer; // drawn into, 0 for the window
+    b4 headless;
+#ifdef SGL_HEADLESS
+    EGLDisplay display;
+    EGLContext context;
+    GLuint renderbuffers[2]; // color, depth
+#endif
 } sgl;
 
 struct RENDER_STATE {
@@ -66,6 +134,7 @@ struct RENDER_STATE {
     vec3 world;
     vec3 scale;
     GLuint texture;
+    u4 layer;
     mat3x3 orient;
 };
 
@@ -78,25 +147,52 @@ struct IMAGE {
 
 struct Library 
 {
+    /*
+        With texture arrays id is shared by every texture packed into the
+        same array and layer picks the texture, see texturearray.cpp.
+    */
     struct Texture {
-        string name;
+        char* name;
+        Handle handle;
         GLuint id;
+        u4 layer;
+        u4 format;
+        u4 width;
+        u4 height;
+        u4 level_count;
     };
     Texture* textures = 0;
-    u4 texture_count = 0;
+    u4 texture_count = 0; // slots ever used
+    u4 texture_capacity = 0;
 
     /* ---------- */
 
+    /*
+        Names and vertex data live in permanent memory. The vertex and
+        index arrays are only kept after upload if requested, otherwise
+        they are 0. The counts are always kept.
+
+        Vertices are interleaved in vertex_buffer, PackedVertex or
+        FloatVertex by vertex_format, see vertexformat.cpp. vertex_array
+        holds the attribute setup and index_buffer, 0 without vertex
+        array objects. The bounding sphere is in mesh units, for culling
+        along with data.bounds_min/max.
+    */
     struct Mesh {
-        string name;
-        vector<glm::vec3> vertices;
-        vector<glm::vec2> uvs;
-        vector<glm::vec3> normals;
+        char* name;
+        Handle handle;
+        MeshData data;
+        u4 vertex_format;
         GLuint vertex_buffer;
-        GLuint uv_buffer;
+        GLuint index_buffer;
+        GLuint vertex_array;
+        glm::vec3 sphere_center;
+        f4 sphere_radius;
+        void* hull_block; // malloc'd, data's hull points into it, see keep_hull
     };
     Mesh* meshes = 0;
     u4 mesh_count = 0;
+    u4 mesh_capacity = 0;
 } library;
 
 // input
@@ -0,0 +1,142 @@
+/*
+    Packed vertex format
+
+    16 bytes per vertex in one interleaved buffer, instead of 24 bytes
+    of FloatVertex:
+        position  3 x u16, normalized to the mesh AABB, + 1 u16 of padding
+        normal    2 x s16, octahedral encoding
+        uv        2 x half float
+
+    basic_texture.v.glsl decodes it: positions come back through the
+    position_offset/position_scale uniforms (AABB min and extent), and
+    oct_decode unfolds the normal. Half float attributes need GL 3.0 or
+    ARB_half_float_vertex, without them meshes stay in the float format,
+    interleaved the same way.
+
+    Quantization error is extent / 65535 per axis, for a 2 unit mesh that
+    is 0.03 thousandths of a unit.
+*/
+
+enum VERTEX_FORMATS {
+    VERTEX_FLOAT = 0,
+    VERTEX_PACKED,
+};
+
+struct PackedVertex
+{
+    u2 position[4];
+    s2 normal[2];
+    u2 uv[2];
+};
+
+struct FloatVertex
+{
+    f4 position[3];
+    s2 normal[2];
+    f4 uv[2];
+};
+
+global_variable u4 vertex_format = VERTEX_FLOAT;
+
+// Round to nearest even, overflow goes to infinity, tiny values flush through subnormals to 0
+u2 float_to_half(f4 value)
+{
+    u4 bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    u4 sign = (bits >> 16) & 0x8000;
+    s4 exponent = (s4)((bits >> 23) & 0xFF) - 127 + 15;
+    u4 mantissa = bits & 0x7FFFFF;
+
+    if (((bits >> 23) & 0xFF) == 0xFF) // inf, nan
+    {
+        return (u2)(sign | 0x7C00 | (mantissa ? 0x200 : 0));
+    }
+    if (exponent >= 31)
+    {
+        return (u2)(sign | 0x7C00);
+    }
+    if (exponent <= 0)
+    {
+        if (exponent < -10) return (u2)sign;
+        mantissa |= 0x800000;
+        u4 shift = (u4)(14 - exponent);
+        u4 half = mantissa >> shift;
+        u4 rest = mantissa & ((1u << shift) - 1);
+        u4 halfway = 1u << (shift - 1);
+        if (rest > halfway || (rest == halfway && (half & 1))) half++;
+        return (u2)(sign | half);
+    }
+
+    u4 half = sign | ((u4)exponent << 10) | (mantissa >> 13);
+    u4 rest = mantissa & 0x1FFF;
+    if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) half++; // may carry into the exponent, which is right
+    return (u2)half;
+}
+
+inline s2 to_snorm16(f4 v)
+{
+    v = v < -1.0f ? -1.0f : (v > 1.0f ? 1.0f : v);
+    return (s2)(v >= 0.0f ? v * 32767.0f + 0.5f : v * 32767.0f - 0.5f);
+}
+
+/*
+    Projects the unit sphere onto an octahedron and unfolds the lower half
+    over the corners, so a direction fits in two numbers in [-1, 1]
+*/
+void oct_encode(glm::vec3 n, s2 out[2])
+{
+    f4 sum = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    if (sum == 0.0f)
+    {
+        out[0] = out[1] = 0; // no normal in the OBJ
+        return;
+    }
+    f4 x = n.x / sum;
+    f4 y = n.y / sum;
+    if (n.z < 0.0f)
+    {
+        f4 fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+        f4 fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    out[0] = to_snorm16(x);
+    out[1] = to_snorm16(y);
+}
+
+void pack_vertices(MeshData &mesh, PackedVertex* out)
+{
+    glm::vec3 extent = mesh.bounds_max - mesh.bounds_min;
+    glm::vec3 inverse;
+    for (u4 k = 0; k < 3; k++)
+    {
+        inverse[k] = extent[k] > 0.0f ? 65535.0f / extent[k] : 0.0f;
+    }
+
+    for (u4 i = 0; i < mesh.vertex_count; i++)
+    {
+        PackedVertex &v = out[i];
+        for (u4 k = 0; k < 3; k++)
+        {
+            f4 q = (mesh.vertices[i][k] - mesh.bounds_min[k]) * inverse[k] + 0.5f;
+            v.position[k] = (u2)(q < 0.0f ? 0.0f : (q > 65535.0f ? 65535.0f : q));
+        }
+        v.position[3] = 0;
+        oct_encode(mesh.normals[i], v.normal);
+        v.uv[0] = float_to_half(mesh.uvs[i].x);
+        v.uv[1] = float_to_half(mesh.uvs[i].y);
+    }
+}
+
+void interleave_vertices(MeshData &mesh, FloatVertex* out)
+{
+    for (u4 i = 0; i < mesh.vertex_count; i++)
+    {
+        FloatVertex &v = out[i];
+        for (u4 k = 0; k < 3; k++) v.position[k] = mesh.vertices[i][k];
+        oct_encode(mesh.normals[i], v.normal);
+        v.uv[0] = mesh.uvs[i].x;
+        v.uv[1] = mesh.uvs[i].y;
+    }
+}